@@ -0,0 +1,213 @@
+#include "corpus_loader.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <charconv>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <execution>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "document.h"
+#include "index_file.h"
+#include "search_server.h"
+#include "string_processing.h"
+
+using namespace std;
+
+namespace {
+
+/// Batches parsed ahead of the one being indexed
+constexpr const size_t QUEUE_CAPACITY = 2;
+
+/// Queue of at most capacity items between a producer and a consumer
+template <typename T>
+class BoundedQueue {
+   public:
+    explicit BoundedQueue(size_t capacity) : capacity_{capacity} {}
+
+    /// Blocks while the queue is full. Returns false if the queue is closed.
+    bool Push(T item) {
+        unique_lock lock(mutex_);
+        not_full_.wait(lock, [this]() {
+            return is_closed_ || items_.size() < capacity_;
+        });
+        if (is_closed_) {
+            return false;
+        }
+        items_.push_back(move(item));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    /// Blocks while the queue is empty and open. Returns nothing once it is closed and drained.
+    optional<T> Pop() {
+        unique_lock lock(mutex_);
+        not_empty_.wait(lock, [this]() {
+            return is_closed_ || !items_.empty();
+        });
+        if (items_.empty()) {
+            return nullopt;
+        }
+        T item = move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return item;
+    }
+
+    /// Wakes both sides: pushing fails from now on, popping drains the items left
+    void Close() {
+        lock_guard guard(mutex_);
+        is_closed_ = true;
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+   private:
+    size_t capacity_;
+    mutex mutex_;
+    condition_variable not_full_;
+    condition_variable not_empty_;
+    deque<T> items_;
+    bool is_closed_ = false;
+};
+
+[[noreturn]] void ThrowMalformedLine(size_t line_number, const string& reason) {
+    throw invalid_argument("Corpus line "s + to_string(line_number) + ": "s + reason);
+}
+
+/// Next tab-separated field of line, removed from it
+string_view TakeField(string_view& line, size_t line_number) {
+    const size_t tab = line.find('\t');
+    if (tab == line.npos) {
+        ThrowMalformedLine(line_number, "expected id, status, ratings and text separated by tabs"s);
+    }
+    const string_view field = line.substr(0, tab);
+    line.remove_prefix(tab + 1);
+    return field;
+}
+
+int ParseInt(string_view text, size_t line_number) {
+    int value = 0;
+    const auto [end, error] = from_chars(text.data(), text.data() + text.size(), value);
+    if (error != errc() || end != text.data() + text.size()) {
+        ThrowMalformedLine(line_number, "invalid number "s + string(text));
+    }
+    return value;
+}
+
+DocumentStatus ParseStatus(string_view text, size_t line_number) {
+    static constexpr pair<string_view, DocumentStatus> STATUSES[] = {{"ACTUAL"sv, DocumentStatus::ACTUAL},
+                                                                     {"IRRELEVANT"sv, DocumentStatus::IRRELEVANT},
+                                                                     {"BANNED"sv, DocumentStatus::BANNED},
+                                                                     {"REMOVED"sv, DocumentStatus::REMOVED}};
+    for (const auto& [name, status] : STATUSES) {
+        if (text == name) {
+            return status;
+        }
+    }
+    ThrowMalformedLine(line_number, "unknown status "s + string(text));
+}
+
+NewDocument ParseLine(string_view line, size_t line_number) {
+    NewDocument document;
+    document.id = ParseInt(TakeField(line, line_number), line_number);
+    document.status = ParseStatus(TakeField(line, line_number), line_number);
+    ForEachWord(TakeField(line, line_number), [&document, line_number](const string_view rating) {
+        document.ratings.push_back(ParseInt(rating, line_number));
+    });
+    document.text = line;
+    return document;
+}
+
+/// Splits the corpus into batches of parsed lines and pushes them to queue until the end or until the queue is closed
+void ParseCorpus(string_view corpus, size_t batch_size, BoundedQueue<vector<NewDocument>>& queue) {
+    vector<NewDocument> batch;
+    size_t line_number = 0;
+    while (!corpus.empty()) {
+        const size_t end = min(corpus.find('\n'), corpus.size());
+        string_view line = corpus.substr(0, end);
+        corpus.remove_prefix(min(end + 1, corpus.size()));
+        ++line_number;
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        if (line.empty()) {
+            continue;
+        }
+
+        try {
+            batch.push_back(ParseLine(line, line_number));
+        } catch (...) {
+            // Documents before the malformed line are still added
+            if (!batch.empty()) {
+                queue.Push(move(batch));
+            }
+            throw;
+        }
+        if (batch.size() == batch_size) {
+            if (!queue.Push(move(batch))) {
+                return;
+            }
+            batch.clear();
+        }
+    }
+    if (!batch.empty()) {
+        queue.Push(move(batch));
+    }
+}
+
+}  // namespace
+
+size_t LoadCorpus(const string& path, SearchServer& server, size_t batch_size) {
+    if (batch_size == 0) {
+        throw invalid_argument("Corpus batch size must be positive"s);
+    }
+    const MappedFile file(path);
+    if (file.Size() > 0) {
+        // Read-ahead keeps up with a front-to-back scan, so loading waits on the disk rather than on page faults
+        madvise(const_cast<char*>(file.Data()), file.Size(), MADV_SEQUENTIAL);
+    }
+
+    BoundedQueue<vector<NewDocument>> queue(QUEUE_CAPACITY);
+    exception_ptr parse_error;
+    thread parser([&]() {
+        try {
+            ParseCorpus(string_view(file.Data(), file.Size()), batch_size, queue);
+        } catch (...) {
+            parse_error = current_exception();
+        }
+        queue.Close();
+    });
+
+    const int document_count = server.GetDocumentCount();
+    exception_ptr index_error;
+    try {
+        while (auto batch = queue.Pop()) {
+            server.AddDocuments(execution::par, *batch);
+        }
+    } catch (...) {
+        index_error = current_exception();
+        queue.Close();
+    }
+    parser.join();
+
+    // Documents are parsed ahead, so a failed batch comes before any malformed line the parser has reached
+    if (index_error) {
+        rethrow_exception(index_error);
+    }
+    if (parse_error) {
+        rethrow_exception(parse_error);
+    }
+    return static_cast<size_t>(server.GetDocumentCount() - document_count);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "search_server.h"
+
+/// Documents of a corpus file given to SearchServer::AddDocuments at once
+constexpr const size_t CORPUS_BATCH_SIZE = 50'000;
+
+/// Adds documents of a corpus file to server and returns how many were added.
+///
+/// Every non-empty line holds a document as tab-separated fields: id, status (ACTUAL, IRRELEVANT, BANNED or REMOVED),
+/// space-separated ratings and text. The file is mapped and texts are indexed right from its pages. One thread
+/// splits lines and parses fields into batches while the server tokenizes and indexes the previous batch in parallel;
+/// a bounded queue between them keeps at most two batches in flight.
+///
+/// Throws std::runtime_error if the file cannot be read and std::invalid_argument for a malformed line or a
+/// document AddDocuments rejects. Documents before the failing one stay added.
+size_t LoadCorpus(const std::string& path, SearchServer& server, size_t batch_size = CORPUS_BATCH_SIZE);
@@ -2,6 +2,7 @@
 
 #include <ostream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 struct Document {
@@ -53,6 +54,26 @@ inline std::ostream& operator<<(std::ostream& out, const DocumentStatus& status)
     return out;
 }
 
+/// Document passed to SearchServer::AddDocuments; the text must outlive the call
+struct NewDocument {
+    int id = 0;
+
+    std::string_view text;
+
+    DocumentStatus status = DocumentStatus::ACTUAL;
+
+    std::vector<int> ratings;
+};
+
+/// Plus words of a query found in a document, sorted, as SearchServer::MatchDocument returns them
+struct DocumentMatch {
+    int id = 0;
+
+    std::vector<std::string_view> words;
+
+    DocumentStatus status = DocumentStatus::ACTUAL;
+};
+
 void PrintDocument(const Document& document);
 
 void PrintMatchDocumentResult(int document_id, const std::vector<std::string_view>& words, DocumentStatus status);
@@ -0,0 +1,159 @@
+#include "durable_search_server.h"
+
+#include <algorithm>
+#include <cctype>
+#include <execution>
+#include <filesystem>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "index_file.h"
+
+using namespace std;
+
+DurableSearchServer::DurableSearchServer(const string& directory, const SearchServer& initial_server) : directory_{directory} {
+    filesystem::create_directories(directory_);
+    const auto index_generations = ListGenerations("index"sv);
+    if (index_generations.empty()) {
+        initial_server.SaveIndex(GetIndexPath(0));
+    }
+    const uint64_t base_generation = index_generations.empty() ? 0 : index_generations.back();
+    server_ = SearchServer::LoadIndex(GetIndexPath(base_generation));
+    RemoveSuperseded(base_generation);
+
+    // Segments before the last one were synced completely before the next one was started, so only the last one
+    // may end with a torn record, and writing continues there
+    generation_ = base_generation;
+    size_t valid_size = 0;
+    for (const uint64_t generation : ListGenerations("log"sv)) {
+        valid_size = WriteAheadLog::Replay(GetLogPath(generation), server_);
+        generation_ = generation;
+    }
+    log_ = make_shared<WriteAheadLog>(GetLogPath(generation_), valid_size);
+    SyncDirectory();
+}
+
+int DurableSearchServer::GetDocumentCount() const {
+    shared_lock lock(mutex_);
+    return server_.GetDocumentCount();
+}
+
+void DurableSearchServer::AddDocument(int document_id, string_view document, DocumentStatus status, const vector<int>& ratings) {
+    Apply([&](SearchServer& server, WriteAheadLog& log) {
+        server.AddDocument(document_id, document, status, ratings);
+        log.AppendAddDocument(document_id, document, status, ratings);
+    });
+}
+
+void DurableSearchServer::AddDocuments(const vector<NewDocument>& documents) {
+    Apply([&documents](SearchServer& server, WriteAheadLog& log) {
+        // Documents before the first invalid one are added even if the batch throws
+        // Counts stay in the signed type of GetDocumentCount, so a batch that left fewer documents logs nothing
+        const int document_count = server.GetDocumentCount();
+        exception_ptr error;
+        try {
+            server.AddDocuments(execution::par, documents);
+        } catch (...) {
+            error = current_exception();
+        }
+        const int added_count = server.GetDocumentCount() - document_count;
+        for (int i = 0; i < added_count; ++i) {
+            log.AppendAddDocument(documents[i].id, documents[i].text, documents[i].status, documents[i].ratings);
+        }
+        if (error) {
+            rethrow_exception(error);
+        }
+    });
+}
+
+void DurableSearchServer::RemoveDocument(int document_id) {
+    Apply([document_id](SearchServer& server, WriteAheadLog& log) {
+        const int document_count = server.GetDocumentCount();
+        server.RemoveDocument(document_id);
+        if (server.GetDocumentCount() < document_count) {
+            log.AppendRemoveDocument(document_id);
+        }
+    });
+}
+
+void DurableSearchServer::RemoveDuplicates() {
+    Apply([](SearchServer& server, WriteAheadLog& log) {
+        vector<int> ids_before(server.begin(), server.end());
+        server.RemoveDuplicates();
+        vector<int> ids_after(server.begin(), server.end());
+        sort(ids_before.begin(), ids_before.end());
+        sort(ids_after.begin(), ids_after.end());
+        vector<int> removed_ids;
+        set_difference(ids_before.begin(), ids_before.end(), ids_after.begin(), ids_after.end(), back_inserter(removed_ids));
+        for (const int id : removed_ids) {
+            log.AppendRemoveDocument(id);
+        }
+    });
+}
+
+void DurableSearchServer::Compact() {
+    lock_guard compaction_guard(compaction_mutex_);
+    SearchServer snapshot;
+    uint64_t generation = 0;
+    {
+        unique_lock lock(mutex_);
+        // A record of the next segment must never be durable while an earlier one is not
+        log_->Sync(log_->GetLastSequence());
+        snapshot = server_;
+        generation = ++generation_;
+        log_ = make_shared<WriteAheadLog>(GetLogPath(generation), 0);
+    }
+    SyncDirectory();
+
+    // Removed documents are purged off the lock, so mutations never wait for it
+    snapshot.PurgeRemovedDocuments();
+    // Until the snapshot is renamed into place, recovery replays both segments over the previous snapshot;
+    // SaveIndex syncs the directory after the rename
+    snapshot.SaveIndex(GetIndexPath(generation));
+    RemoveSuperseded(generation);
+}
+
+string DurableSearchServer::GetIndexPath(uint64_t generation) const {
+    return (filesystem::path(directory_) / ("index."s + to_string(generation))).string();
+}
+
+string DurableSearchServer::GetLogPath(uint64_t generation) const {
+    return (filesystem::path(directory_) / ("log."s + to_string(generation))).string();
+}
+
+vector<uint64_t> DurableSearchServer::ListGenerations(string_view prefix) const {
+    vector<uint64_t> generations;
+    for (const auto& entry : filesystem::directory_iterator(directory_)) {
+        const string name = entry.path().filename().string();
+        if (name.size() <= prefix.size() + 1 || name.compare(0, prefix.size(), prefix) != 0 || name[prefix.size()] != '.') {
+            continue;
+        }
+        const string_view number = string_view(name).substr(prefix.size() + 1);
+        if (all_of(number.begin(), number.end(), [](unsigned char c) {
+                return isdigit(c);
+            })) {
+            generations.push_back(stoull(string(number)));
+        }
+    }
+    sort(generations.begin(), generations.end());
+    return generations;
+}
+
+void DurableSearchServer::RemoveSuperseded(uint64_t generation) const {
+    for (const string_view prefix : {"index"sv, "log"sv}) {
+        for (const uint64_t old_generation : ListGenerations(prefix)) {
+            if (old_generation < generation) {
+                filesystem::remove(prefix == "index"sv ? GetIndexPath(old_generation) : GetLogPath(old_generation));
+            }
+        }
+    }
+}
+
+void DurableSearchServer::SyncDirectory() const {
+    ::SyncDirectory(directory_);
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "document.h"
+#include "search_server.h"
+#include "write_ahead_log.h"
+
+/// Search server whose mutations survive restarts.
+///
+/// The directory holds a base snapshot index.N written by SaveIndex and log segments log.N, log.N+1, ... with the
+/// mutations made since. Every mutation is applied, appended to the current segment and synced before the call
+/// returns; concurrent mutations share one fsync. Compact starts a new segment and writes the state before it
+/// as the next base snapshot, then drops the files it supersedes, so a crash at any point loses no synced mutation.
+class DurableSearchServer {
+   public:
+    /// Restores the server from directory: loads the newest base snapshot and replays the log segments after it.
+    /// An empty directory is initialized with initial_server.
+    DurableSearchServer(const std::string& directory, const SearchServer& initial_server);
+
+    template <typename... Args>
+    std::vector<Document> FindTopDocuments(Args&&... args) const {
+        std::shared_lock lock(mutex_);
+        return server_.FindTopDocuments(std::forward<Args>(args)...);
+    }
+
+    /// Matched words stay valid until the server is destroyed
+    template <typename... Args>
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(Args&&... args) const {
+        std::shared_lock lock(mutex_);
+        return server_.MatchDocument(std::forward<Args>(args)...);
+    }
+
+    int GetDocumentCount() const;
+
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status = DocumentStatus::ACTUAL,
+                     const std::vector<int>& ratings = {});
+
+    /// Adds documents like SearchServer::AddDocuments, logging the added ones
+    void AddDocuments(const std::vector<NewDocument>& documents);
+
+    void RemoveDocument(int document_id);
+
+    /// Removed duplicates are logged as removals of their ids
+    void RemoveDuplicates();
+
+    /// Writes the current state as a new base snapshot and drops the log segments it covers.
+    /// Mutations proceed while the snapshot is written.
+    void Compact();
+
+   private:
+    std::string directory_;
+    mutable std::shared_mutex mutex_;
+    SearchServer server_;
+    /// Generation of the current log segment
+    uint64_t generation_ = 0;
+    std::shared_ptr<WriteAheadLog> log_;
+    /// Serializes compactions
+    std::mutex compaction_mutex_;
+
+    std::string GetIndexPath(uint64_t generation) const;
+
+    std::string GetLogPath(uint64_t generation) const;
+
+    /// Generations of files named prefix.N in the directory, ascending
+    std::vector<uint64_t> ListGenerations(std::string_view prefix) const;
+
+    /// Removes snapshots and log segments of generations before generation
+    void RemoveSuperseded(uint64_t generation) const;
+
+    /// Makes created and renamed files of the directory durable, throws std::runtime_error if the sync fails
+    void SyncDirectory() const;
+
+    /// Runs mutation(server, log) under the lock, then waits until everything it appended is synced.
+    /// The mutation may throw after appending records; they are synced before the exception is rethrown.
+    template <typename Mutation>
+    void Apply(Mutation mutation);
+};
+
+template <typename Mutation>
+void DurableSearchServer::Apply(Mutation mutation) {
+    // Records are appended under the lock, so the log keeps the order of application. The sync runs outside of it,
+    // and mutations appended meanwhile by other threads join the same fsync.
+    std::shared_ptr<WriteAheadLog> log;
+    WriteAheadLog::Sequence sequence = 0;
+    std::exception_ptr error;
+    {
+        std::unique_lock lock(mutex_);
+        log = log_;
+        try {
+            mutation(server_, *log);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        sequence = log->GetLastSequence();
+    }
+    log->Sync(sequence);
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
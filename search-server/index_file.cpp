@@ -0,0 +1,228 @@
+#include "index_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+constexpr const char INDEX_FILE_MAGIC[8] = {'S', 'R', 'C', 'H', 'I', 'D', 'X', '\0'};
+/// Reads back as another number on a machine with the other byte order
+constexpr const uint32_t BYTE_ORDER_MARK = 0x01020304;
+constexpr const size_t SECTION_ALIGNMENT = 64;
+
+struct IndexFileHeader {
+    char magic[8] = {};
+    uint32_t byte_order = 0;
+    uint32_t version = 0;
+    uint64_t section_count = 0;
+    /// Checksum of the section table
+    uint64_t table_checksum = 0;
+};
+
+size_t AlignSection(size_t offset) {
+    return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+}  // namespace
+
+// ----------------------------------------------------------------
+// MappedFile implementation
+// ----------------------------------------------------------------
+
+MappedFile::MappedFile(const string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error("Cannot open file "s + path + ": "s + strerror(errno));
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        const int error = errno;
+        close(fd);
+        throw runtime_error("Cannot stat file "s + path + ": "s + strerror(error));
+    }
+    size_ = static_cast<size_t>(file_stat.st_size);
+    if (size_ > 0) {
+        void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            const int error = errno;
+            close(fd);
+            throw runtime_error("Cannot map file "s + path + ": "s + strerror(error));
+        }
+        data_ = static_cast<const char*>(data);
+    }
+    // The mapping keeps the file alive
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+}
+
+// ----------------------------------------------------------------
+// IndexFileWriter implementation
+// ----------------------------------------------------------------
+
+void IndexFileWriter::Write(const string& path) const {
+    IndexFileHeader header;
+    memcpy(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic));
+    header.byte_order = BYTE_ORDER_MARK;
+    header.version = INDEX_FILE_VERSION;
+    header.section_count = sections_.size();
+
+    vector<IndexSectionEntry> entries(sections_.size());
+    size_t offset = AlignSection(sizeof(header) + entries.size() * sizeof(IndexSectionEntry));
+    for (size_t i = 0; i < sections_.size(); ++i) {
+        const Section& section = sections_[i];
+        entries[i] = {static_cast<uint32_t>(section.id), static_cast<uint32_t>(section.element_size), offset, section.size,
+                      ComputeChecksum(section.data, section.size)};
+        offset = AlignSection(offset + section.size);
+    }
+    header.table_checksum = ComputeChecksum(entries.data(), entries.size() * sizeof(IndexSectionEntry));
+
+    const string temp_path = path + ".tmp"s;
+    {
+        ofstream out(temp_path, ios::binary | ios::trunc);
+        if (!out) {
+            throw runtime_error("Cannot create index file "s + temp_path);
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(IndexSectionEntry));
+        size_t position = sizeof(header) + entries.size() * sizeof(IndexSectionEntry);
+        const char padding[SECTION_ALIGNMENT] = {};
+        for (size_t i = 0; i < sections_.size(); ++i) {
+            out.write(padding, entries[i].offset - position);
+            out.write(static_cast<const char*>(sections_[i].data), sections_[i].size);
+            position = entries[i].offset + sections_[i].size;
+        }
+        out.flush();
+        if (!out) {
+            out.close();
+            remove(temp_path.c_str());
+            throw runtime_error("Cannot write index file "s + temp_path);
+        }
+    }
+    // The data must reach the disk before the rename does, or a crash may leave a renamed but empty file
+    const int fd = open(temp_path.c_str(), O_RDONLY);
+    if (fd < 0 || fsync(fd) != 0) {
+        const int error = errno;
+        if (fd >= 0) {
+            close(fd);
+        }
+        remove(temp_path.c_str());
+        throw runtime_error("Cannot sync index file "s + temp_path + ": "s + strerror(error));
+    }
+    close(fd);
+    if (rename(temp_path.c_str(), path.c_str()) != 0) {
+        const int error = errno;
+        remove(temp_path.c_str());
+        throw runtime_error("Cannot replace index file "s + path + ": "s + strerror(error));
+    }
+    // The rename itself is an entry of the directory, lost in a crash until the directory is synced
+    const filesystem::path directory = filesystem::path(path).parent_path();
+    SyncDirectory(directory.empty() ? "."s : directory.string());
+}
+
+// ----------------------------------------------------------------
+// IndexFileReader implementation
+// ----------------------------------------------------------------
+
+IndexFileReader::IndexFileReader(const string& path, bool verify_checksums) : file_{make_shared<MappedFile>(path)} {
+    const size_t file_size = file_->Size();
+    IndexFileHeader header;
+    if (file_size < sizeof(header)) {
+        throw runtime_error("Index file "s + path + " is truncated"s);
+    }
+    memcpy(&header, file_->Data(), sizeof(header));
+    if (memcmp(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic)) != 0) {
+        throw runtime_error("File "s + path + " is not an index file"s);
+    }
+    if (header.byte_order != BYTE_ORDER_MARK) {
+        throw runtime_error("Index file "s + path + " was written with another byte order"s);
+    }
+    if (header.version != INDEX_FILE_VERSION) {
+        throw runtime_error("Index file "s + path + " has unsupported version "s + to_string(header.version));
+    }
+    if (header.section_count > (file_size - sizeof(header)) / sizeof(IndexSectionEntry)) {
+        throw runtime_error("Index file "s + path + " is truncated"s);
+    }
+
+    sections_ = reinterpret_cast<const IndexSectionEntry*>(file_->Data() + sizeof(header));
+    section_count_ = header.section_count;
+    if (ComputeChecksum(sections_, section_count_ * sizeof(IndexSectionEntry)) != header.table_checksum) {
+        throw runtime_error("Index file "s + path + " is corrupted"s);
+    }
+    for (size_t i = 0; i < section_count_; ++i) {
+        const IndexSectionEntry& entry = sections_[i];
+        if (entry.offset % SECTION_ALIGNMENT != 0 || entry.offset > file_size || entry.size > file_size - entry.offset) {
+            throw runtime_error("Index file "s + path + " is truncated"s);
+        }
+        if (verify_checksums && ComputeChecksum(file_->Data() + entry.offset, entry.size) != entry.checksum) {
+            throw runtime_error("Index file "s + path + " is corrupted"s);
+        }
+    }
+}
+
+const IndexSectionEntry& IndexFileReader::FindSection(IndexSection id, size_t element_size) const {
+    for (size_t i = 0; i < section_count_; ++i) {
+        const IndexSectionEntry& entry = sections_[i];
+        if (entry.id != static_cast<uint32_t>(id)) {
+            continue;
+        }
+        if (entry.element_size != element_size || entry.size % element_size != 0) {
+            throw runtime_error("Index section "s + to_string(entry.id) + " has unexpected layout"s);
+        }
+        return entry;
+    }
+    throw runtime_error("Index section "s + to_string(static_cast<uint32_t>(id)) + " is missing"s);
+}
+
+// ----------------------------------------------------------------
+// Helper methods implementation
+// ----------------------------------------------------------------
+
+uint64_t ComputeChecksum(const void* data, size_t size) {
+    constexpr uint64_t MULTIPLIER = 0x9E3779B97F4A7C15ull;
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    uint64_t checksum = size;
+    size_t pos = 0;
+    for (; pos + sizeof(uint64_t) <= size; pos += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes + pos, sizeof(word));
+        checksum = (checksum ^ word) * MULTIPLIER;
+        checksum ^= checksum >> 32;
+    }
+    uint64_t tail = 0;
+    if (pos < size) {
+        memcpy(&tail, bytes + pos, size - pos);
+    }
+    checksum = (checksum ^ tail) * MULTIPLIER;
+    return checksum ^ (checksum >> 32);
+}
+
+void SyncDirectory(const string& directory) {
+    const int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0 || fsync(fd) != 0) {
+        const int error = errno;
+        if (fd >= 0) {
+            close(fd);
+        }
+        throw runtime_error("Cannot sync directory "s + directory + ": "s + strerror(error));
+    }
+    close(fd);
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mapped_array.h"
+
+/// Sections of a binary index file
+enum class IndexSection : uint32_t {
+    METADATA = 1,
+    TERM_CHARS,
+    TERM_LOCATIONS,
+    TERM_HASHES,
+    TERM_SLOTS,
+    POSTING_SLICES,
+    POSTING_BLOCKS,
+    POSTING_BYTES,
+    POSTING_MAX_FREQS,
+    DOCUMENT_INVERSE_LENGTHS,
+    DOCUMENT_TERM_ENDS,
+    DOCUMENT_TERMS,
+    DOCUMENTS,
+    DOCUMENT_ID_ORDINALS,
+    CONTENT_HASHES,
+    LOG_DOCUMENT_FREQS,
+    DOCUMENT_BAND_KEYS,
+};
+
+/// Entry of the section table of an index file; offset and size are in bytes from the start of the file
+struct IndexSectionEntry {
+    uint32_t id = 0;
+    uint32_t element_size = 0;
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    uint64_t checksum = 0;
+};
+
+/// Current version of the binary index format. Files of other versions are rejected.
+constexpr const uint32_t INDEX_FILE_VERSION = 4;
+
+/// Read-only memory mapping of a whole file, shared by all processes mapping the same file
+class MappedFile {
+   public:
+    /// Maps file at path, throws std::runtime_error if it cannot be opened or mapped
+    explicit MappedFile(const std::string& path);
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile();
+
+    const char* Data() const {
+        return data_;
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+   private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+/// Builds a binary index file: a header, a table of sections and the sections, each aligned to 64 bytes, so that
+/// arrays of any element type can be used right in the mapped pages. Every section carries its element size and a
+/// checksum. Numbers are stored in the native byte order; the header records it, and files of the other order are rejected.
+class IndexFileWriter {
+   public:
+    /// Adds section referring to count elements at data; the memory must stay alive until Write
+    template <typename T>
+    void AddSection(IndexSection id, const T* data, size_t count) {
+        sections_.push_back({id, sizeof(T), data, count * sizeof(T)});
+    }
+
+    template <typename T>
+    void AddSection(IndexSection id, const MappedArray<T>& elements) {
+        AddSection(id, elements.data(), elements.size());
+    }
+
+    /// Adds section owning elements
+    template <typename T>
+    void AddSection(IndexSection id, std::vector<T> elements) {
+        auto owner = std::make_shared<std::vector<T>>(std::move(elements));
+        AddSection(id, owner->data(), owner->size());
+        KeepAlive(std::move(owner));
+    }
+
+    /// Keeps owner of section memory alive until the writer is destroyed
+    void KeepAlive(std::shared_ptr<const void> owner) {
+        owners_.push_back(std::move(owner));
+    }
+
+    /// Writes and syncs file next to path, renames it over path and syncs the directory, so readers never see a
+    /// partially written file and the new file survives a crash once Write returns. Throws std::runtime_error on
+    /// write and sync errors.
+    void Write(const std::string& path) const;
+
+   private:
+    struct Section {
+        IndexSection id;
+        size_t element_size = 0;
+        const void* data = nullptr;
+        size_t size = 0;
+    };
+
+    std::vector<Section> sections_;
+    std::vector<std::shared_ptr<const void>> owners_;
+};
+
+/// Validates a mapped binary index file and hands out its sections as arrays borrowing the mapped pages
+class IndexFileReader {
+   public:
+    /// Maps file at path and checks its header and section table. With verify_checksums every section is checked too,
+    /// which reads the whole file once; without it only the pages touched by queries are ever read.
+    /// Throws std::runtime_error if the file is not a valid index file of the current version.
+    explicit IndexFileReader(const std::string& path, bool verify_checksums = true);
+
+    /// Section as an array, throws std::runtime_error if it is missing or holds elements of another size
+    template <typename T>
+    MappedArray<T> GetArray(IndexSection id) const {
+        const IndexSectionEntry& entry = FindSection(id, sizeof(T));
+        return MappedArray<T>::Borrow(reinterpret_cast<const T*>(file_->Data() + entry.offset), entry.size / sizeof(T));
+    }
+
+    /// Mapping the arrays borrow from
+    std::shared_ptr<const MappedFile> GetFile() const {
+        return file_;
+    }
+
+   private:
+    std::shared_ptr<const MappedFile> file_;
+    const IndexSectionEntry* sections_ = nullptr;
+    size_t section_count_ = 0;
+
+    const IndexSectionEntry& FindSection(IndexSection id, size_t element_size) const;
+};
+
+/// Checksum of size bytes at data
+uint64_t ComputeChecksum(const void* data, size_t size);
+
+/// Makes files created, renamed or removed in directory survive a crash. Throws std::runtime_error if it fails.
+void SyncDirectory(const std::string& directory);
@@ -0,0 +1,528 @@
+#include "inverted_index.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <execution>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "posting_codec.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------
+// PostingCursor implementation
+// ----------------------------------------------------------------
+
+PostingCursor::PostingCursor(const InvertedIndex& index, TermId term) : index_{&index}, term_{term} {
+    if (term < index.compressed_slices_.size()) {
+        const auto& compressed_slice = index.compressed_slices_[term];
+        block_ = compressed_slice.first_block;
+        block_end_ = compressed_slice.first_block + compressed_slice.block_count;
+    }
+    LoadNextRun();
+}
+
+PostingCursor::PostingCursor(const PostingCursor& other) {
+    *this = other;
+}
+
+PostingCursor& PostingCursor::operator=(const PostingCursor& other) {
+    if (this == &other) {
+        return *this;
+    }
+    index_ = other.index_;
+    term_ = other.term_;
+    block_ = other.block_;
+    block_end_ = other.block_end_;
+    is_plain_loaded_ = other.is_plain_loaded_;
+    pos_ = other.pos_;
+    size_ = other.size_;
+    if (other.IsBuffered()) {
+        copy_n(other.ordinal_buffer_.begin(), size_, ordinal_buffer_.begin());
+        copy_n(other.freq_buffer_.begin(), size_, freq_buffer_.begin());
+        ordinals_ = ordinal_buffer_.data();
+        freqs_ = freq_buffer_.data();
+    } else {
+        ordinals_ = other.ordinals_;
+        freqs_ = other.freqs_;
+    }
+    return *this;
+}
+
+void PostingCursor::Seek(DocumentOrdinal ordinal) {
+    while (!IsEnd()) {
+        if (ordinals_[size_ - 1] >= ordinal) {
+            pos_ = lower_bound(ordinals_ + pos_, ordinals_ + size_, ordinal) - ordinals_;
+            return;
+        }
+        if (!is_plain_loaded_ && block_ < block_end_) {
+            const auto* blocks = index_->blocks_.data();
+            block_ = lower_bound(blocks + block_, blocks + block_end_, ordinal,
+                                 [](const InvertedIndex::CompressedBlock& block, DocumentOrdinal value) {
+                                     return block.last_ordinal < value;
+                                 }) -
+                     blocks;
+        }
+        LoadNextRun();
+    }
+}
+
+double PostingCursor::MaxTermFreq(DocumentOrdinal ordinal) const {
+    if (IsEnd()) {
+        return 0.0;
+    }
+    if (ordinal <= ordinals_[size_ - 1]) {
+        return IsBuffered() ? index_->blocks_[block_ - 1].max_freq : index_->max_freqs_[term_];
+    }
+    if (!is_plain_loaded_) {
+        const auto* blocks = index_->blocks_.data();
+        const auto* block = lower_bound(blocks + block_, blocks + block_end_, ordinal,
+                                        [](const InvertedIndex::CompressedBlock& block, DocumentOrdinal value) {
+                                            return block.last_ordinal < value;
+                                        });
+        if (block != blocks + block_end_) {
+            return block->max_freq;
+        }
+        if (term_ < index_->slices_.size() && index_->slices_[term_].size > 0) {
+            return index_->max_freqs_[term_];
+        }
+    }
+    return 0.0;
+}
+
+void PostingCursor::LoadNextRun() {
+    pos_ = 0;
+    size_ = 0;
+    while (block_ < block_end_) {
+        const auto& block = index_->blocks_[block_++];
+        if (block.count > 0) {
+            index_->DecodeBlock(block, ordinal_buffer_.data(), freq_buffer_.data());
+            ordinals_ = ordinal_buffer_.data();
+            freqs_ = freq_buffer_.data();
+            size_ = block.count;
+            return;
+        }
+    }
+    if (!is_plain_loaded_) {
+        LoadPlain();
+    }
+}
+
+void PostingCursor::LoadPlain() {
+    is_plain_loaded_ = true;
+    if (term_ >= index_->slices_.size()) {
+        return;
+    }
+    const auto& slice = index_->slices_[term_];
+    ordinals_ = index_->ordinals_.data() + slice.offset;
+    freqs_ = index_->freqs_.data() + slice.offset;
+    size_ = slice.size;
+}
+
+bool PostingCursor::IsBuffered() const {
+    return ordinals_ == ordinal_buffer_.data();
+}
+
+// ----------------------------------------------------------------
+// InvertedIndex implementation
+// ----------------------------------------------------------------
+
+InvertedIndex InvertedIndex::Load(const IndexFileReader& reader) {
+    InvertedIndex result;
+    result.compressed_slices_ = reader.GetArray<CompressedSlice>(IndexSection::POSTING_SLICES);
+    result.blocks_ = reader.GetArray<CompressedBlock>(IndexSection::POSTING_BLOCKS);
+    result.compressed_bytes_ = reader.GetArray<uint8_t>(IndexSection::POSTING_BYTES);
+    result.max_freqs_ = reader.GetArray<double>(IndexSection::POSTING_MAX_FREQS);
+    result.inverse_lengths_ = reader.GetArray<double>(IndexSection::DOCUMENT_INVERSE_LENGTHS);
+    if (result.max_freqs_.size() != result.compressed_slices_.size() || (!result.blocks_.empty() && result.compressed_bytes_.size() < STREAM_VBYTE_PADDING)) {
+        throw runtime_error("Postings of the index file are inconsistent"s);
+    }
+    return result;
+}
+
+void InvertedIndex::Add(TermId term, DocumentOrdinal ordinal, double term_freq) {
+    ExtendTerms(term + size_t{1});
+    if (term >= slices_.size()) {
+        slices_.resize(term + 1);
+    }
+    auto& max_freqs = max_freqs_.Mutable();
+    assert(compressed_slices_[term].block_count == 0 ||
+           blocks_[compressed_slices_[term].first_block + compressed_slices_[term].block_count - 1].last_ordinal < ordinal);
+
+    const auto first = ordinals_.begin() + slices_[term].offset;
+    const auto last = first + slices_[term].size;
+    const auto pos = lower_bound(first, last, ordinal);
+    if (pos != last && *pos == ordinal) {
+        freqs_[pos - ordinals_.begin()] += term_freq;
+        max_freqs[term] = max(max_freqs[term], freqs_[pos - ordinals_.begin()]);
+        return;
+    }
+
+    // Grow may move the slice, so the insert position is kept as an index relative to the slice start
+    const size_t rank = pos - first;
+    Slice& slice = slices_[term];
+    if (slice.size == slice.capacity) {
+        Grow(slice);
+    }
+
+    const size_t at = slice.offset + rank;
+    const size_t end = slice.offset + slice.size;
+    copy_backward(ordinals_.begin() + at, ordinals_.begin() + end, ordinals_.begin() + end + 1);
+    copy_backward(freqs_.begin() + at, freqs_.begin() + end, freqs_.begin() + end + 1);
+    ordinals_[at] = ordinal;
+    freqs_[at] = term_freq;
+    ++slice.size;
+    max_freqs[term] = max(max_freqs[term], term_freq);
+
+    if (abandoned_ > ordinals_.size() / 2) {
+        Compact();
+    }
+}
+
+void InvertedIndex::AddBatch(DocumentOrdinal first_ordinal, const vector<vector<DocumentTerm>>& document_terms, size_t chunk_count) {
+    if (document_terms.empty()) {
+        return;
+    }
+    const size_t document_count = document_terms.size();
+    chunk_count = clamp(chunk_count, size_t{1}, document_count);
+    const size_t chunk_size = (document_count + chunk_count - 1) / chunk_count;
+    chunk_count = (document_count + chunk_size - 1) / chunk_size;
+
+    size_t term_count = TermCount();
+    for (const auto& terms : document_terms) {
+        if (!terms.empty()) {
+            term_count = max(term_count, terms.back().term + size_t{1});
+        }
+    }
+    ExtendTerms(term_count);
+    slices_.resize(term_count);
+
+    vector<size_t> chunks(chunk_count);
+    iota(chunks.begin(), chunks.end(), 0ul);
+    const auto for_each_chunk_document = [&](size_t chunk, auto action) {
+        const size_t first = chunk * chunk_size;
+        const size_t last = min(document_count, first + chunk_size);
+        for (size_t index = first; index < last; ++index) {
+            for (const DocumentTerm& document_term : document_terms[index]) {
+                action(static_cast<DocumentOrdinal>(first_ordinal + index), document_term);
+            }
+        }
+    };
+
+    // Every chunk counts its postings per term, the counts then become write positions of the chunk in the slices
+    vector<vector<size_t>> positions(chunk_count, vector<size_t>(term_count, 0));
+    for_each(execution::par, chunks.begin(), chunks.end(), [&](size_t chunk) {
+        auto& chunk_positions = positions[chunk];
+        for_each_chunk_document(chunk, [&chunk_positions](DocumentOrdinal, const DocumentTerm& document_term) {
+            ++chunk_positions[document_term.term];
+        });
+    });
+
+    vector<TermId> added_terms;
+    for (TermId term = 0; term < term_count; ++term) {
+        size_t added = 0;
+        for (const auto& chunk_positions : positions) {
+            added += chunk_positions[term];
+        }
+        if (added == 0) {
+            continue;
+        }
+        added_terms.push_back(term);
+        Slice& slice = slices_[term];
+        if (slice.size + added > slice.capacity) {
+            Grow(slice, slice.size + added);
+        }
+        size_t position = slice.offset + slice.size;
+        for (auto& chunk_positions : positions) {
+            position += exchange(chunk_positions[term], position);
+        }
+        slice.size += added;
+    }
+
+    for_each(execution::par, chunks.begin(), chunks.end(), [&](size_t chunk) {
+        auto& chunk_positions = positions[chunk];
+        for_each_chunk_document(chunk, [this, &chunk_positions](DocumentOrdinal ordinal, const DocumentTerm& document_term) {
+            const size_t at = chunk_positions[document_term.term]++;
+            ordinals_[at] = ordinal;
+            freqs_[at] = document_term.freq;
+        });
+    });
+
+    // Postings of the batch are the tail of every slice
+    auto& max_freqs = max_freqs_.Mutable();
+    for_each(execution::par, added_terms.begin(), added_terms.end(), [this, first_ordinal, &max_freqs](TermId term) {
+        const Slice& slice = slices_[term];
+        const auto first = ordinals_.begin() + slice.offset;
+        const auto batch_first = lower_bound(first, first + slice.size, first_ordinal);
+        const auto freqs_first = freqs_.begin() + (batch_first - ordinals_.begin());
+        max_freqs[term] = max(max_freqs[term], *max_element(freqs_first, freqs_.begin() + slice.offset + slice.size));
+    });
+
+    if (abandoned_ > ordinals_.size() / 2) {
+        Compact();
+    }
+}
+
+void InvertedIndex::MarkRemoved(TermId term, uint32_t count) {
+    assert(term < removed_counts_.size() && DocumentFreq(term) >= count);
+    removed_counts_[term] += count;
+}
+
+void InvertedIndex::Purge(const vector<DocumentOrdinal>& new_ordinals) {
+    const auto renumber = [&new_ordinals](DocumentOrdinal ordinal) {
+        return ordinal < new_ordinals.size() ? new_ordinals[ordinal] : NO_ORDINAL;
+    };
+    // Bounds of terms with removed postings are recomputed from the postings left; compressed ones add theirs below
+    auto& max_freqs = max_freqs_.Mutable();
+    for (TermId term = 0; term < removed_counts_.size(); ++term) {
+        if (removed_counts_[term] > 0) {
+            max_freqs[term] = 0.0;
+        }
+    }
+    for (TermId term = 0; term < slices_.size(); ++term) {
+        Slice& slice = slices_[term];
+        const bool has_removals = term < removed_counts_.size() && removed_counts_[term] > 0;
+        size_t kept = slice.offset;
+        for (size_t at = slice.offset; at < slice.offset + slice.size; ++at) {
+            const DocumentOrdinal ordinal = renumber(ordinals_[at]);
+            if (ordinal != NO_ORDINAL) {
+                ordinals_[kept] = ordinal;
+                freqs_[kept] = freqs_[at];
+                if (has_removals) {
+                    max_freqs[term] = max(max_freqs[term], freqs_[kept]);
+                }
+                ++kept;
+            }
+        }
+        slice.size = kept - slice.offset;
+    }
+
+    // Lengths move with their documents, so a word count encoded again equals the one decoded
+    vector<double> inverse_lengths(count_if(new_ordinals.begin(), new_ordinals.end(), [](DocumentOrdinal ordinal) {
+        return ordinal != NO_ORDINAL;
+    }));
+    for (DocumentOrdinal ordinal = 0; ordinal < inverse_lengths_.size(); ++ordinal) {
+        if (const DocumentOrdinal new_ordinal = renumber(ordinal); new_ordinal != NO_ORDINAL) {
+            inverse_lengths[new_ordinal] = inverse_lengths_[ordinal];
+        }
+    }
+
+    if (!blocks_.empty()) {
+        vector<CompressedSlice> compressed_slices(TermCount());
+        vector<CompressedBlock> blocks;
+        vector<uint8_t> bytes;
+        vector<DocumentOrdinal> ordinals;
+        vector<double> freqs;
+        array<DocumentOrdinal, POSTING_BLOCK_SIZE> block_ordinals;
+        array<double, POSTING_BLOCK_SIZE> block_freqs;
+        for (TermId term = 0; term < TermCount(); ++term) {
+            ordinals.clear();
+            freqs.clear();
+            const auto& compressed_slice = compressed_slices_[term];
+            for (size_t block = compressed_slice.first_block; block < compressed_slice.first_block + compressed_slice.block_count; ++block) {
+                DecodeBlock(blocks_[block], block_ordinals.data(), block_freqs.data());
+                for (size_t i = 0; i < blocks_[block].count; ++i) {
+                    if (const DocumentOrdinal ordinal = renumber(block_ordinals[i]); ordinal != NO_ORDINAL) {
+                        ordinals.push_back(ordinal);
+                        freqs.push_back(block_freqs[i]);
+                    }
+                }
+            }
+            compressed_slices[term] = EncodeTerm(ordinals, freqs, inverse_lengths.data(), blocks, bytes);
+            if (term < removed_counts_.size() && removed_counts_[term] > 0 && !freqs.empty()) {
+                max_freqs[term] = max(max_freqs[term], *max_element(freqs.begin(), freqs.end()));
+            }
+        }
+        SetCompressed(move(compressed_slices), move(blocks), move(bytes));
+    }
+    inverse_lengths_.Mutable() = move(inverse_lengths);
+    fill(removed_counts_.begin(), removed_counts_.end(), 0u);
+}
+
+size_t InvertedIndex::DocumentFreq(TermId term) const {
+    if (term >= TermCount()) {
+        return 0;
+    }
+    const size_t removed_count = term < removed_counts_.size() ? removed_counts_[term] : 0;
+    return (term < slices_.size() ? slices_[term].size : 0) + compressed_slices_[term].size - removed_count;
+}
+
+size_t InvertedIndex::TermCount() const {
+    return compressed_slices_.size();
+}
+
+double InvertedIndex::MaxTermFreq(TermId term) const {
+    if (term >= max_freqs_.size()) {
+        return 0.0;
+    }
+    return max_freqs_[term];
+}
+
+void InvertedIndex::SetDocumentLength(DocumentOrdinal ordinal, size_t word_count) {
+    auto& inverse_lengths = inverse_lengths_.Mutable();
+    if (ordinal >= inverse_lengths.size()) {
+        inverse_lengths.resize(ordinal + 1);
+    }
+    inverse_lengths[ordinal] = word_count > 0 ? 1.0 / word_count : 0.0;
+}
+
+void InvertedIndex::Compact() {
+    size_t total = 0;
+    for (const Slice& slice : slices_) {
+        total += slice.size;
+    }
+
+    vector<DocumentOrdinal> ordinals;
+    vector<double> freqs;
+    ordinals.reserve(total);
+    freqs.reserve(total);
+    for (Slice& slice : slices_) {
+        const size_t offset = ordinals.size();
+        ordinals.insert(ordinals.end(), ordinals_.begin() + slice.offset, ordinals_.begin() + slice.offset + slice.size);
+        freqs.insert(freqs.end(), freqs_.begin() + slice.offset, freqs_.begin() + slice.offset + slice.size);
+        slice.offset = offset;
+        slice.capacity = slice.size;
+    }
+
+    ordinals_ = move(ordinals);
+    freqs_ = move(freqs);
+    abandoned_ = 0;
+}
+
+void InvertedIndex::Compress() {
+    vector<CompressedSlice> compressed_slices(TermCount());
+    vector<CompressedBlock> blocks;
+    vector<uint8_t> bytes;
+
+    auto& max_freqs = max_freqs_.Mutable();
+    vector<DocumentOrdinal> ordinals;
+    vector<double> freqs;
+    for (TermId term = 0; term < TermCount(); ++term) {
+        ordinals.clear();
+        freqs.clear();
+        for (PostingCursor cursor(*this, term); !cursor.IsEnd(); cursor.Next()) {
+            ordinals.push_back(cursor.Ordinal());
+            freqs.push_back(cursor.TermFreq());
+        }
+        compressed_slices[term] = EncodeTerm(ordinals, freqs, inverse_lengths_.data(), blocks, bytes);
+        max_freqs[term] = freqs.empty() ? 0.0 : *max_element(freqs.begin(), freqs.end());
+    }
+
+    SetCompressed(move(compressed_slices), move(blocks), move(bytes));
+    vector<Slice>{}.swap(slices_);
+    vector<DocumentOrdinal>{}.swap(ordinals_);
+    vector<double>{}.swap(freqs_);
+    abandoned_ = 0;
+}
+
+size_t InvertedIndex::MemoryUsage() const {
+    return slices_.capacity() * sizeof(Slice) + ordinals_.capacity() * sizeof(DocumentOrdinal) + freqs_.capacity() * sizeof(double) +
+           max_freqs_.MemoryUsage() + compressed_slices_.MemoryUsage() + blocks_.MemoryUsage() + compressed_bytes_.MemoryUsage() +
+           inverse_lengths_.MemoryUsage() + removed_counts_.capacity() * sizeof(uint32_t);
+}
+
+void InvertedIndex::Detach() {
+    max_freqs_.Mutable();
+    compressed_slices_.Mutable();
+    blocks_.Mutable();
+    compressed_bytes_.Mutable();
+    inverse_lengths_.Mutable();
+    removed_counts_.resize(TermCount());
+}
+
+void InvertedIndex::Save(IndexFileWriter& writer) const {
+    assert(all_of(removed_counts_.begin(), removed_counts_.end(), [](uint32_t count) {
+        return count == 0;
+    }));
+    if (!ordinals_.empty()) {
+        auto compressed = make_shared<InvertedIndex>(*this);
+        compressed->Compress();
+        compressed->Save(writer);
+        writer.KeepAlive(move(compressed));
+        return;
+    }
+    writer.AddSection(IndexSection::POSTING_SLICES, compressed_slices_);
+    writer.AddSection(IndexSection::POSTING_BLOCKS, blocks_);
+    writer.AddSection(IndexSection::POSTING_BYTES, compressed_bytes_);
+    writer.AddSection(IndexSection::POSTING_MAX_FREQS, max_freqs_);
+    writer.AddSection(IndexSection::DOCUMENT_INVERSE_LENGTHS, inverse_lengths_);
+}
+
+void InvertedIndex::Grow(Slice& slice, size_t min_capacity) {
+    const size_t capacity = max({MIN_SLICE_CAPACITY, slice.capacity * 2, min_capacity});
+    const size_t offset = ordinals_.size();
+    ordinals_.resize(offset + capacity);
+    freqs_.resize(offset + capacity);
+    copy_n(ordinals_.begin() + slice.offset, slice.size, ordinals_.begin() + offset);
+    copy_n(freqs_.begin() + slice.offset, slice.size, freqs_.begin() + offset);
+
+    abandoned_ += slice.capacity;
+    slice.offset = offset;
+    slice.capacity = capacity;
+}
+
+void InvertedIndex::ExtendTerms(size_t term_count) {
+    if (term_count > TermCount()) {
+        compressed_slices_.Mutable().resize(term_count);
+        max_freqs_.Mutable().resize(term_count);
+        removed_counts_.resize(term_count);
+    }
+}
+
+InvertedIndex::CompressedSlice InvertedIndex::EncodeTerm(const vector<DocumentOrdinal>& ordinals, const vector<double>& freqs,
+                                                        const double* inverse_lengths, vector<CompressedBlock>& blocks,
+                                                        vector<uint8_t>& bytes) {
+    CompressedSlice compressed_slice;
+    compressed_slice.first_block = blocks.size();
+    compressed_slice.size = ordinals.size();
+    DocumentOrdinal base = 0;
+    for (size_t start = 0; start < ordinals.size(); start += POSTING_BLOCK_SIZE) {
+        CompressedBlock block;
+        block.base = base;
+        block.offset = bytes.size();
+        EncodeBlock(ordinals.data() + start, freqs.data() + start, min(POSTING_BLOCK_SIZE, ordinals.size() - start), inverse_lengths,
+                    block, bytes);
+        base = block.last_ordinal;
+        blocks.push_back(block);
+    }
+    compressed_slice.block_count = blocks.size() - compressed_slice.first_block;
+    return compressed_slice;
+}
+
+void InvertedIndex::SetCompressed(vector<CompressedSlice> compressed_slices, vector<CompressedBlock> blocks, vector<uint8_t> bytes) {
+    bytes.resize(bytes.size() + STREAM_VBYTE_PADDING);
+    bytes.shrink_to_fit();
+    compressed_slices_.Mutable() = move(compressed_slices);
+    blocks_.Mutable() = move(blocks);
+    compressed_bytes_.Mutable() = move(bytes);
+}
+
+void InvertedIndex::EncodeBlock(const DocumentOrdinal* ordinals, const double* freqs, size_t count, const double* inverse_lengths,
+                                CompressedBlock& block, vector<uint8_t>& out) {
+    array<uint32_t, POSTING_BLOCK_SIZE> word_counts;
+    for (size_t i = 0; i < count; ++i) {
+        word_counts[i] = static_cast<uint32_t>(lround(freqs[i] / inverse_lengths[ordinals[i]]));
+    }
+    EncodeStreamVByteDeltas(ordinals, count, block.base, out);
+    EncodeStreamVByte(word_counts.data(), count, out);
+    block.count = static_cast<uint32_t>(count);
+    block.last_ordinal = count > 0 ? ordinals[count - 1] : block.base;
+    block.max_freq = count > 0 ? *max_element(freqs, freqs + count) : 0.0;
+}
+
+void InvertedIndex::DecodeBlock(const CompressedBlock& block, DocumentOrdinal* ordinals, double* freqs) const {
+    array<uint32_t, POSTING_BLOCK_SIZE> word_counts;
+    const uint8_t* in = compressed_bytes_.data() + block.offset;
+    in = DecodeStreamVByteDeltas(in, block.count, block.base, ordinals);
+    DecodeStreamVByte(in, block.count, word_counts.data());
+    const double* inverse_lengths = inverse_lengths_.data();
+    for (size_t i = 0; i < block.count; ++i) {
+        freqs[i] = word_counts[i] * inverse_lengths[ordinals[i]];
+    }
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "index_file.h"
+#include "mapped_array.h"
+#include "term_dictionary.h"
+
+/// Dense internal document number assigned by the search server in insertion order
+using DocumentOrdinal = uint32_t;
+
+/// Ordinal a purge gives to removed documents
+constexpr const DocumentOrdinal NO_ORDINAL = std::numeric_limits<DocumentOrdinal>::max();
+
+/// Frequency of a term in one document
+struct DocumentTerm {
+    TermId term = NO_TERM;
+    double freq = 0.0;
+};
+
+/// Number of postings encoded together in one compressed block
+constexpr const size_t POSTING_BLOCK_SIZE = 128;
+
+class InvertedIndex;
+
+/// Forward iterator over one term's postings in ascending ordinal order.
+/// Walks the compressed blocks of the term first, decoding one block at a time, then its plain slice.
+class PostingCursor {
+   public:
+    PostingCursor(const InvertedIndex& index, TermId term);
+
+    PostingCursor(const PostingCursor& other);
+
+    PostingCursor& operator=(const PostingCursor& other);
+
+    bool IsEnd() const {
+        return pos_ == size_;
+    }
+
+    DocumentOrdinal Ordinal() const {
+        return ordinals_[pos_];
+    }
+
+    double TermFreq() const {
+        return freqs_[pos_];
+    }
+
+    void Next() {
+        if (++pos_ == size_) {
+            LoadNextRun();
+        }
+    }
+
+    /// Moves to the first posting with ordinal not less than the given one
+    void Seek(DocumentOrdinal ordinal);
+
+    /// Upper bound of the term frequency of a posting with the given ordinal, taken from the maximum of the
+    /// block that would hold it, without decoding. The ordinal must not precede the current posting.
+    double MaxTermFreq(DocumentOrdinal ordinal) const;
+
+   private:
+    const InvertedIndex* index_;
+    TermId term_;
+    size_t block_ = 0;
+    size_t block_end_ = 0;
+    bool is_plain_loaded_ = false;
+
+    // Current run of postings: either the decoded block buffers or the plain slice
+    const DocumentOrdinal* ordinals_ = nullptr;
+    const double* freqs_ = nullptr;
+    size_t pos_ = 0;
+    size_t size_ = 0;
+
+    std::array<DocumentOrdinal, POSTING_BLOCK_SIZE> ordinal_buffer_;
+    std::array<double, POSTING_BLOCK_SIZE> freq_buffer_;
+
+    void LoadNextRun();
+
+    void LoadPlain();
+
+    bool IsBuffered() const;
+};
+
+/// Inverted index stored compressed-sparse-row style: every term owns a contiguous, ordinal-sorted slice
+/// of two flat arrays (ordinals and frequencies). Slices keep some slack to absorb insertions; a slice that
+/// overflows is moved to the tail of the arrays, and the arrays are compacted once the abandoned space
+/// outweighs the live postings.
+///
+/// Compress moves all postings into blocks of POSTING_BLOCK_SIZE: Stream VByte coded ordinal deltas and
+/// word counts of the term in the document. Term frequencies are restored from the counts and document
+/// lengths, so compression is lossless. Postings added later go to the plain slice after the compressed
+/// blocks of the term until the next Compress.
+///
+/// Compressed arrays may be borrowed from a mapped index file; the first mutation takes private copies of them.
+class InvertedIndex {
+   public:
+    /// Index borrowing its compressed postings from a mapped index file
+    static InvertedIndex Load(const IndexFileReader& reader);
+
+    /// Adds term frequency of term for document.
+    /// Ordinals are expected to grow, so the posting is usually appended to the end of the slice.
+    void Add(TermId term, DocumentOrdinal ordinal, double term_freq);
+
+    /// Adds postings of documents with ordinals first_ordinal, first_ordinal + 1, ... given their terms sorted by term.
+    /// The documents must follow every indexed ordinal. They are split into chunk_count chunks that count and
+    /// write their postings concurrently, and every slice is grown at most once.
+    void AddBatch(DocumentOrdinal first_ordinal, const std::vector<std::vector<DocumentTerm>>& document_terms, size_t chunk_count);
+
+    /// Accounts for count postings of term whose documents were removed: the postings leave DocumentFreq at once but
+    /// stay in the posting list, and cursors keep returning them, until Purge.
+    /// Calls for different terms are independent and may run concurrently once the index owns its arrays (see Detach).
+    void MarkRemoved(TermId term, uint32_t count);
+
+    /// Renumbers every posting of ordinal i to new_ordinals[i], dropping postings mapped to NO_ORDINAL, and the
+    /// document lengths along with them. New ordinals must keep the order of the old ones. Plain slices are rewritten
+    /// in place; compressed postings are decoded and encoded again.
+    void Purge(const std::vector<DocumentOrdinal>& new_ordinals);
+
+    /// Number of documents containing term, postings marked removed excluded
+    size_t DocumentFreq(TermId term) const;
+
+    /// Number of terms with postings
+    size_t TermCount() const;
+
+    /// Upper bound of term frequencies of term. Removals do not lower it until the next Compress.
+    double MaxTermFreq(TermId term) const;
+
+    /// Word count of document, needed to restore term frequencies of compressed postings
+    void SetDocumentLength(DocumentOrdinal ordinal, size_t word_count);
+
+    /// Rebuilds flat arrays without slack and abandoned slices
+    void Compact();
+
+    /// Encodes every posting into compressed blocks and releases the plain arrays
+    void Compress();
+
+    /// Heap memory taken by postings, in bytes
+    size_t MemoryUsage() const;
+
+    /// Takes private copies of arrays borrowed from an index file
+    void Detach();
+
+    /// Adds the posting sections to writer. The file holds compressed postings only, so plain ones are compressed
+    /// into a copy kept alive by writer. Postings marked removed must be purged first.
+    void Save(IndexFileWriter& writer) const;
+
+   private:
+    friend class PostingCursor;
+
+    struct Slice {
+        size_t offset = 0;
+        size_t size = 0;
+        size_t capacity = 0;
+    };
+
+    struct CompressedSlice {
+        size_t first_block = 0;
+        size_t block_count = 0;
+        size_t size = 0;
+    };
+
+    struct CompressedBlock {
+        /// The first ordinal delta is taken relative to base
+        DocumentOrdinal base = 0;
+        DocumentOrdinal last_ordinal = 0;
+        size_t offset = 0;
+        uint32_t count = 0;
+        /// Largest term frequency in the block
+        double max_freq = 0.0;
+    };
+
+    static constexpr size_t MIN_SLICE_CAPACITY = 4;
+
+    /// Slices indexed by term id; terms past the end have no plain postings
+    std::vector<Slice> slices_;
+    std::vector<DocumentOrdinal> ordinals_;
+    std::vector<double> freqs_;
+    size_t abandoned_ = 0;
+    /// Upper bounds of term frequencies indexed by term id, sized to the number of terms
+    MappedArray<double> max_freqs_;
+    /// Postings marked removed indexed by term id; sized to the number of terms by Detach
+    std::vector<uint32_t> removed_counts_;
+
+    /// Compressed slices indexed by term id, sized to the number of terms
+    MappedArray<CompressedSlice> compressed_slices_;
+    MappedArray<CompressedBlock> blocks_;
+    MappedArray<uint8_t> compressed_bytes_;
+    MappedArray<double> inverse_lengths_;
+
+    /// Extends per-term arrays to at least term_count terms
+    void ExtendTerms(size_t term_count);
+
+    /// Moves slice to the tail of the arrays with at least min_capacity, doubling its capacity otherwise
+    void Grow(Slice& slice, size_t min_capacity = 0);
+
+    /// Appends blocks of postings of one term to blocks and bytes and returns its compressed slice; word counts are
+    /// restored from the term frequencies and inverse_lengths indexed by ordinal
+    static CompressedSlice EncodeTerm(const std::vector<DocumentOrdinal>& ordinals, const std::vector<double>& freqs,
+                                      const double* inverse_lengths, std::vector<CompressedBlock>& blocks, std::vector<uint8_t>& bytes);
+
+    /// Replaces the compressed arrays with ones built by EncodeTerm
+    void SetCompressed(std::vector<CompressedSlice> compressed_slices, std::vector<CompressedBlock> blocks, std::vector<uint8_t> bytes);
+
+    /// Appends encoded postings to out and fills count, last ordinal and maximum frequency of block
+    static void EncodeBlock(const DocumentOrdinal* ordinals, const double* freqs, size_t count, const double* inverse_lengths,
+                            CompressedBlock& block, std::vector<uint8_t>& out);
+
+    /// Decodes block into buffers of POSTING_BLOCK_SIZE elements
+    void DecodeBlock(const CompressedBlock& block, DocumentOrdinal* ordinals, double* freqs) const;
+};
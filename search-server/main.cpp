@@ -12,6 +12,24 @@
 using namespace std;
 
 int main() {
+    TestCompressIndex();
+    TestPrunedFindTopDocuments();
+    TestAddDocuments();
+    TestSnapshotSearchServer();
+    TestShardedSearchServer();
+    TestSaveLoadIndex();
+    TestDurableSearchServer();
+    TestQueryExecutor();
+    TestQueryCache();
+    TestPreparedQuery();
+    TestForEachCheckedWord();
+    TestLoadCorpus();
+    TestPurgeRemovedDocuments();
+    TestDuplicateDocuments();
+    TestNearDuplicateDocuments();
+    TestBatchMatchDocuments();
+    TestRequestQueue();
+    TestMetrics();
     {
         TestParFindTopDocuments();
 
@@ -20,10 +38,12 @@ int main() {
         const auto dictionary = GenerateDictionary(generator, 1000, 10);
         const auto documents = GenerateQueries(generator, dictionary, 10'000, 70);
 
-        SearchServer search_server(dictionary[0]);
+        vector<NewDocument> batch;
         for (size_t i = 0; i < documents.size(); ++i) {
-            search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, {1, 2, 3});
+            batch.push_back({static_cast<int>(i), documents[i], DocumentStatus::ACTUAL, {1, 2, 3}});
         }
+        SearchServer search_server(dictionary[0]);
+        search_server.AddDocuments(execution::par, batch);
 
         const auto queries = GenerateQueries(generator, dictionary, 100, 70, 0.1);
 
@@ -40,10 +60,12 @@ int main() {
 
         const string query = GenerateQuery(generator, dictionary, 500, 0.1);
 
-        SearchServer search_server(dictionary[0]);
+        vector<NewDocument> batch;
         for (size_t i = 0; i < documents.size(); ++i) {
-            search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, {1, 2, 3});
+            batch.push_back({static_cast<int>(i), documents[i], DocumentStatus::ACTUAL, {1, 2, 3}});
         }
+        SearchServer search_server(dictionary[0]);
+        search_server.AddDocuments(execution::par, batch);
 
         TEST_MATCH_DOCUMENT(seq);
         TEST_MATCH_DOCUMENT(par);
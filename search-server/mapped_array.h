@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+/// Read-only view of a contiguous range of elements
+template <typename T>
+class ArrayView {
+   public:
+    ArrayView() = default;
+
+    ArrayView(const T* first, const T* last) : first_{first}, last_{last} {}
+
+    const T* begin() const {
+        return first_;
+    }
+
+    const T* end() const {
+        return last_;
+    }
+
+    size_t size() const {
+        return last_ - first_;
+    }
+
+    bool empty() const {
+        return first_ == last_;
+    }
+
+    const T& operator[](size_t index) const {
+        return first_[index];
+    }
+
+    const T& back() const {
+        return last_[-1];
+    }
+
+   private:
+    const T* first_ = nullptr;
+    const T* last_ = nullptr;
+};
+
+/// Array of trivially copyable elements that either owns them or borrows read-only memory owned elsewhere,
+/// e.g. pages of a mapped index file. Borrowed elements are copied on the first call to Mutable.
+template <typename T>
+class MappedArray {
+    static_assert(std::is_trivially_copyable_v<T>, "Mapped elements must be trivially copyable");
+
+   public:
+    MappedArray() = default;
+
+    /// Array referring to count elements at data; the memory must outlive the array and all its copies
+    static MappedArray Borrow(const T* data, size_t count) {
+        MappedArray result;
+        result.borrowed_ = count > 0 ? data : nullptr;
+        result.borrowed_size_ = count;
+        return result;
+    }
+
+    const T* data() const {
+        return borrowed_ != nullptr ? borrowed_ : owned_.data();
+    }
+
+    size_t size() const {
+        return borrowed_ != nullptr ? borrowed_size_ : owned_.size();
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    const T& operator[](size_t index) const {
+        return data()[index];
+    }
+
+    const T* begin() const {
+        return data();
+    }
+
+    const T* end() const {
+        return data() + size();
+    }
+
+    const T& back() const {
+        return end()[-1];
+    }
+
+    bool IsBorrowed() const {
+        return borrowed_ != nullptr;
+    }
+
+    /// Owned elements, taking a private copy of borrowed ones first
+    std::vector<T>& Mutable() {
+        if (borrowed_ != nullptr) {
+            owned_.assign(borrowed_, borrowed_ + borrowed_size_);
+            borrowed_ = nullptr;
+            borrowed_size_ = 0;
+        }
+        return owned_;
+    }
+
+    /// Heap memory taken by owned elements, in bytes; borrowed memory is not counted
+    size_t MemoryUsage() const {
+        return owned_.capacity() * sizeof(T);
+    }
+
+   private:
+    std::vector<T> owned_;
+    const T* borrowed_ = nullptr;
+    size_t borrowed_size_ = 0;
+};
@@ -0,0 +1,345 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+constexpr array<string_view, STAGE_COUNT> STAGE_NAMES = {"query_parse"sv,    "query_minus_words"sv, "query_plus_words"sv, "query_results"sv,
+                                                         "query_top_k"sv,    "add_parse"sv,         "add_index"sv,        "add_statistics"sv,
+                                                         "remove_mark"sv,    "remove_statistics"sv};
+
+constexpr array<string_view, COUNTER_COUNT> COUNTER_NAMES = {"postings_scanned"sv, "documents_scored"sv};
+
+atomic_bool is_metrics_enabled{true};
+
+/// Cells of one thread. Only the owner writes them, so increments are a load and a store rather than atomic
+/// read-modify-writes; atomics only keep concurrent snapshots well-defined.
+struct MetricsShard {
+    struct StageCells {
+        array<atomic_uint64_t, LatencyHistogram::BUCKET_COUNT> buckets{};
+        atomic_uint64_t count{0};
+        atomic_uint64_t sum{0};
+        atomic_uint64_t max{0};
+    };
+
+    array<StageCells, STAGE_COUNT> stages;
+    array<atomic_uint64_t, COUNTER_COUNT> counters{};
+};
+
+void Increase(atomic_uint64_t& cell, uint64_t value) {
+    cell.store(cell.load(memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+/// Seconds of a duration in nanoseconds, written exactly
+string FormatSeconds(uint64_t nanoseconds) {
+    string fraction = to_string(nanoseconds % 1'000'000'000);
+    fraction.insert(0, 9 - fraction.size(), '0');
+    while (!fraction.empty() && fraction.back() == '0') {
+        fraction.pop_back();
+    }
+    return to_string(nanoseconds / 1'000'000'000) + (fraction.empty() ? ""s : "."s + fraction);
+}
+
+void WritePrometheus(const MetricsSnapshot& snapshot, ostream& out) {
+    constexpr string_view NAME = "search_server_stage_duration_seconds"sv;
+    out << "# HELP "sv << NAME << " Duration of stages of search server operations\n"sv;
+    out << "# TYPE "sv << NAME << " histogram\n"sv;
+    for (size_t stage = 0; stage < STAGE_COUNT; ++stage) {
+        const LatencyHistogram& histogram = snapshot.stages[stage];
+        const string labels = "{stage=\""s + string(STAGE_NAMES[stage]) + '"';
+        // Empty buckets add nothing to the cumulative counts, so only the others are written
+        uint64_t cumulative_count = 0;
+        const auto& buckets = histogram.GetBuckets();
+        for (size_t index = 0; index < buckets.size(); ++index) {
+            if (buckets[index] > 0) {
+                cumulative_count += buckets[index];
+                out << NAME << "_bucket"sv << labels << ",le=\""sv << FormatSeconds(LatencyHistogram::GetBucketUpperBound(index)) << "\"} "sv
+                    << cumulative_count << '\n';
+            }
+        }
+        out << NAME << "_bucket"sv << labels << ",le=\"+Inf\"} "sv << histogram.GetCount() << '\n';
+        out << NAME << "_sum"sv << labels << "} "sv << FormatSeconds(histogram.GetSum()) << '\n';
+        out << NAME << "_count"sv << labels << "} "sv << histogram.GetCount() << '\n';
+    }
+    for (size_t counter = 0; counter < COUNTER_COUNT; ++counter) {
+        const string name = "search_server_"s + string(COUNTER_NAMES[counter]) + "_total"s;
+        out << "# TYPE "sv << name << " counter\n"sv;
+        out << name << ' ' << snapshot.counters[counter] << '\n';
+    }
+}
+
+void WriteJson(const MetricsSnapshot& snapshot, ostream& out) {
+    static constexpr pair<string_view, double> PERCENTILES[] = {{"p50_ns"sv, 50.0}, {"p90_ns"sv, 90.0}, {"p99_ns"sv, 99.0}, {"p999_ns"sv, 99.9}};
+    out << "{\"stages\":{"sv;
+    for (size_t stage = 0; stage < STAGE_COUNT; ++stage) {
+        const LatencyHistogram& histogram = snapshot.stages[stage];
+        out << (stage > 0 ? ","sv : ""sv) << '"' << STAGE_NAMES[stage] << "\":{\"count\":"sv << histogram.GetCount() << ",\"sum_ns\":"sv
+            << histogram.GetSum() << ",\"max_ns\":"sv << histogram.GetMax();
+        for (const auto& [name, percentile] : PERCENTILES) {
+            out << ",\""sv << name << "\":"sv << histogram.GetValueAtPercentile(percentile);
+        }
+        // Pairs of the upper bound of a non-empty bucket and its count
+        out << ",\"buckets\":["sv;
+        bool is_first = true;
+        const auto& buckets = histogram.GetBuckets();
+        for (size_t index = 0; index < buckets.size(); ++index) {
+            if (buckets[index] > 0) {
+                out << (is_first ? "["sv : ",["sv) << LatencyHistogram::GetBucketUpperBound(index) << ',' << buckets[index] << ']';
+                is_first = false;
+            }
+        }
+        out << "]}"sv;
+    }
+    out << "},\"counters\":{"sv;
+    for (size_t counter = 0; counter < COUNTER_COUNT; ++counter) {
+        out << (counter > 0 ? ","sv : ""sv) << '"' << COUNTER_NAMES[counter] << "\":"sv << snapshot.counters[counter];
+    }
+    out << "}}\n"sv;
+}
+
+}  // namespace
+
+/// Shards of live threads and the sums of the shards of exited ones
+class MetricsRegistry {
+   public:
+    /// Never destroyed, since threads may exit after static objects are destroyed
+    static MetricsRegistry& GetInstance() {
+        static auto* registry = new MetricsRegistry();
+        return *registry;
+    }
+
+    void Register(const MetricsShard* shard) {
+        lock_guard guard(mutex_);
+        shards_.push_back(shard);
+    }
+
+    void Retire(const MetricsShard* shard) {
+        lock_guard guard(mutex_);
+        AddShard(*shard, retired_);
+        shards_.erase(find(shards_.begin(), shards_.end(), shard));
+    }
+
+    MetricsSnapshot TakeSnapshot() {
+        lock_guard guard(mutex_);
+        MetricsSnapshot result = retired_;
+        for (const MetricsShard* shard : shards_) {
+            AddShard(*shard, result);
+        }
+        return result;
+    }
+
+   private:
+    mutex mutex_;
+    vector<const MetricsShard*> shards_;
+    MetricsSnapshot retired_;
+
+    static void AddShard(const MetricsShard& shard, MetricsSnapshot& snapshot) {
+        for (size_t stage = 0; stage < STAGE_COUNT; ++stage) {
+            const auto& cells = shard.stages[stage];
+            LatencyHistogram& histogram = snapshot.stages[stage];
+            for (size_t index = 0; index < LatencyHistogram::BUCKET_COUNT; ++index) {
+                histogram.buckets_[index] += cells.buckets[index].load(memory_order_relaxed);
+            }
+            histogram.count_ += cells.count.load(memory_order_relaxed);
+            histogram.sum_ += cells.sum.load(memory_order_relaxed);
+            histogram.max_ = max(histogram.max_, cells.max.load(memory_order_relaxed));
+        }
+        for (size_t counter = 0; counter < COUNTER_COUNT; ++counter) {
+            snapshot.counters[counter] += shard.counters[counter].load(memory_order_relaxed);
+        }
+    }
+};
+
+namespace {
+
+/// Shard of the calling thread, registered on first use and merged into the registry when the thread exits
+MetricsShard& GetThreadShard() {
+    struct ShardHolder {
+        unique_ptr<MetricsShard> shard = make_unique<MetricsShard>();
+
+        ShardHolder() {
+            MetricsRegistry::GetInstance().Register(shard.get());
+        }
+
+        ~ShardHolder() {
+            MetricsRegistry::GetInstance().Retire(shard.get());
+        }
+    };
+    thread_local ShardHolder holder;
+    return *holder.shard;
+}
+
+}  // namespace
+
+string_view GetStageName(Stage stage) {
+    return STAGE_NAMES[static_cast<size_t>(stage)];
+}
+
+string_view GetCounterName(Counter counter) {
+    return COUNTER_NAMES[static_cast<size_t>(counter)];
+}
+
+size_t LatencyHistogram::GetBucketIndex(uint64_t value) {
+    constexpr uint64_t SUB_BUCKET_COUNT = uint64_t{1} << SUB_BUCKET_BITS;
+    value = min(value, (uint64_t{1} << MAX_VALUE_BITS) - 1);
+    if (value < SUB_BUCKET_COUNT) {
+        return static_cast<size_t>(value);
+    }
+    // Values with the highest bit at SUB_BUCKET_BITS + shift share a bucket if they agree in the SUB_BUCKET_BITS
+    // bits after it
+    const int shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+    return static_cast<size_t>(((shift + 1) << SUB_BUCKET_BITS) + (value >> shift) - SUB_BUCKET_COUNT);
+}
+
+uint64_t LatencyHistogram::GetBucketUpperBound(size_t index) {
+    constexpr uint64_t SUB_BUCKET_COUNT = uint64_t{1} << SUB_BUCKET_BITS;
+    if (index < SUB_BUCKET_COUNT) {
+        return index;
+    }
+    const int shift = static_cast<int>(index >> SUB_BUCKET_BITS) - 1;
+    const uint64_t mantissa = (index & (SUB_BUCKET_COUNT - 1)) + SUB_BUCKET_COUNT;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void LatencyHistogram::Add(uint64_t value) {
+    ++buckets_[GetBucketIndex(value)];
+    ++count_;
+    sum_ += value;
+    max_ = max(max_, value);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+    for (size_t index = 0; index < BUCKET_COUNT; ++index) {
+        buckets_[index] += other.buckets_[index];
+    }
+    count_ += other.count_;
+    sum_ += other.sum_;
+    max_ = max(max_, other.max_);
+}
+
+uint64_t LatencyHistogram::GetCount() const {
+    return count_;
+}
+
+uint64_t LatencyHistogram::GetSum() const {
+    return sum_;
+}
+
+uint64_t LatencyHistogram::GetMax() const {
+    return max_;
+}
+
+uint64_t LatencyHistogram::GetValueAtPercentile(double percentile) const {
+    if (count_ == 0) {
+        return 0;
+    }
+    const auto rank = max<uint64_t>(1, static_cast<uint64_t>(ceil(clamp(percentile, 0.0, 100.0) / 100.0 * static_cast<double>(count_))));
+    uint64_t cumulative_count = 0;
+    for (size_t index = 0; index < BUCKET_COUNT; ++index) {
+        cumulative_count += buckets_[index];
+        if (cumulative_count >= rank) {
+            return min(GetBucketUpperBound(index), max_);
+        }
+    }
+    return max_;
+}
+
+const array<uint64_t, LatencyHistogram::BUCKET_COUNT>& LatencyHistogram::GetBuckets() const {
+    return buckets_;
+}
+
+void SetMetricsEnabled(bool is_enabled) {
+    is_metrics_enabled.store(is_enabled, memory_order_relaxed);
+}
+
+bool IsMetricsEnabled() {
+    return is_metrics_enabled.load(memory_order_relaxed);
+}
+
+void RecordStage(Stage stage, chrono::steady_clock::duration duration) {
+    if (!IsMetricsEnabled()) {
+        return;
+    }
+    const auto value = static_cast<uint64_t>(max<int64_t>(chrono::duration_cast<chrono::nanoseconds>(duration).count(), 0));
+    auto& cells = GetThreadShard().stages[static_cast<size_t>(stage)];
+    Increase(cells.buckets[LatencyHistogram::GetBucketIndex(value)], 1);
+    Increase(cells.count, 1);
+    Increase(cells.sum, value);
+    if (value > cells.max.load(memory_order_relaxed)) {
+        cells.max.store(value, memory_order_relaxed);
+    }
+}
+
+void AddToCounter(Counter counter, uint64_t value) {
+    if (IsMetricsEnabled()) {
+        Increase(GetThreadShard().counters[static_cast<size_t>(counter)], value);
+    }
+}
+
+MetricsSnapshot TakeMetricsSnapshot() {
+    return MetricsRegistry::GetInstance().TakeSnapshot();
+}
+
+void WriteMetrics(const MetricsSnapshot& snapshot, MetricsFormat format, ostream& out) {
+    if (format == MetricsFormat::PROMETHEUS) {
+        WritePrometheus(snapshot, out);
+    } else {
+        WriteJson(snapshot, out);
+    }
+}
+
+void SaveMetrics(const string& path, MetricsFormat format) {
+    ofstream out(path);
+    if (!out) {
+        throw runtime_error("Cannot create metrics file "s + path);
+    }
+    WriteMetrics(TakeMetricsSnapshot(), format, out);
+    out.close();
+    if (!out) {
+        throw runtime_error("Cannot write metrics file "s + path);
+    }
+}
+
+StageTimer::StageTimer(Stage stage, bool is_running) : stage_{stage}, is_enabled_{IsMetricsEnabled()} {
+    if (is_running) {
+        Start();
+    }
+}
+
+StageTimer::~StageTimer() {
+    if (!has_started_) {
+        return;
+    }
+    Stop();
+    RecordStage(stage_, duration_);
+}
+
+void StageTimer::Start() {
+    if (is_enabled_ && !is_running_) {
+        is_running_ = true;
+        has_started_ = true;
+        start_time_ = Clock::now();
+    }
+}
+
+void StageTimer::Stop() {
+    if (is_running_) {
+        is_running_ = false;
+        duration_ += Clock::now() - start_time_;
+    }
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+// Latency histograms and counters of search server operations. Every thread records into its own shard with plain
+// stores; snapshots sum the shards of all threads, including the ones that have exited. An event costs two
+// steady_clock reads, which dominate it, and a few increments of thread-local memory: tens of nanoseconds. A query
+// records about five events plus two per extra ordinal range of a parallel query, whatever the size of the corpus:
+// no stage is timed per posting or per scoring window. Metrics are on by default so they can stay on in production.
+
+/// Timed stages of search server operations
+enum class Stage : uint8_t {
+    /// Splitting a raw query into words and resolving them to terms
+    QUERY_PARSE,
+    /// Marking documents with minus words; pruned scoring counts it in QUERY_PLUS_WORDS
+    QUERY_MINUS_WORDS,
+    /// Walking posting lists of plus words and scoring documents
+    QUERY_PLUS_WORDS,
+    /// Building found documents of a query
+    QUERY_RESULTS,
+    /// Selecting the most relevant documents
+    QUERY_TOP_K,
+    /// Tokenizing, validating and fingerprinting new documents
+    ADD_PARSE,
+    /// Interning words and adding postings of new documents
+    ADD_INDEX,
+    /// Refreshing IDF of the terms of new documents
+    ADD_STATISTICS,
+    /// Looking up and marking removed documents
+    REMOVE_MARK,
+    /// Refreshing document frequencies and IDF of the terms of removed documents
+    REMOVE_STATISTICS,
+};
+
+constexpr const size_t STAGE_COUNT = 10;
+
+enum class Counter : uint8_t {
+    /// Postings read from posting lists by queries
+    POSTINGS_SCANNED,
+    /// Documents whose relevance queries computed
+    DOCUMENTS_SCORED,
+};
+
+constexpr const size_t COUNTER_COUNT = 2;
+
+/// Name of stage in exported metrics, like "query_parse"
+std::string_view GetStageName(Stage stage);
+
+std::string_view GetCounterName(Counter counter);
+
+/// Histogram of durations in nanoseconds in the style of HdrHistogram: every power of two is split into 16 buckets,
+/// so a bucket is at most 1/16 of its values wide, up to about 36 minutes, where values saturate
+class LatencyHistogram {
+   public:
+    static constexpr int SUB_BUCKET_BITS = 4;
+    static constexpr int MAX_VALUE_BITS = 41;
+    static constexpr size_t BUCKET_COUNT = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS;
+
+    static size_t GetBucketIndex(uint64_t value);
+
+    /// Largest value of the bucket
+    static uint64_t GetBucketUpperBound(size_t index);
+
+    void Add(uint64_t value);
+
+    void Merge(const LatencyHistogram& other);
+
+    uint64_t GetCount() const;
+
+    uint64_t GetSum() const;
+
+    uint64_t GetMax() const;
+
+    /// Upper bound of the bucket holding the value below which percentile percent of values fall, at most the
+    /// maximum; zero for an empty histogram
+    uint64_t GetValueAtPercentile(double percentile) const;
+
+    const std::array<uint64_t, BUCKET_COUNT>& GetBuckets() const;
+
+   private:
+    friend class MetricsRegistry;
+
+    std::array<uint64_t, BUCKET_COUNT> buckets_{};
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t max_ = 0;
+};
+
+/// Metrics of all threads at one moment
+struct MetricsSnapshot {
+    std::array<LatencyHistogram, STAGE_COUNT> stages;
+    std::array<uint64_t, COUNTER_COUNT> counters{};
+
+    const LatencyHistogram& GetStage(Stage stage) const {
+        return stages[static_cast<size_t>(stage)];
+    }
+
+    uint64_t GetCounter(Counter counter) const {
+        return counters[static_cast<size_t>(counter)];
+    }
+};
+
+enum class MetricsFormat {
+    /// Prometheus text exposition format
+    PROMETHEUS,
+    JSON,
+};
+
+/// Metrics are recorded unless disabled; a disabled event costs one relaxed load
+void SetMetricsEnabled(bool is_enabled);
+
+bool IsMetricsEnabled();
+
+void RecordStage(Stage stage, std::chrono::steady_clock::duration duration);
+
+void AddToCounter(Counter counter, uint64_t value);
+
+MetricsSnapshot TakeMetricsSnapshot();
+
+void WriteMetrics(const MetricsSnapshot& snapshot, MetricsFormat format, std::ostream& out);
+
+/// Writes a snapshot of the metrics to a file. Throws std::runtime_error if the file cannot be written.
+void SaveMetrics(const std::string& path, MetricsFormat format);
+
+/// Records time a stage runs as one event when destroyed. A stage running in several intervals, like the windows of
+/// a query, is timed by stopping and starting the timer; only the total is recorded, and nothing if it never started.
+class StageTimer {
+   public:
+    explicit StageTimer(Stage stage, bool is_running = true);
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    ~StageTimer();
+
+    void Start();
+
+    void Stop();
+
+   private:
+    using Clock = std::chrono::steady_clock;
+
+    Stage stage_;
+    bool is_enabled_;
+    bool is_running_ = false;
+    bool has_started_ = false;
+    Clock::time_point start_time_;
+    Clock::duration duration_ = Clock::duration::zero();
+};
@@ -0,0 +1,108 @@
+#include "min_hash.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+using namespace std;
+
+namespace {
+
+constexpr const size_t ROW_COUNT = MIN_HASH_BANDS * MIN_HASH_BAND_ROWS;
+
+/// Top bits of an element hash picking its row
+constexpr const int ROW_BITS = 6;
+static_assert(ROW_COUNT == size_t{1} << ROW_BITS);
+
+constexpr const uint32_t EMPTY_ROW = numeric_limits<uint32_t>::max();
+
+/// Orders in which rows borrow: every row comes first in its own order, the others follow in a fixed random order
+struct LenderOrders {
+    /// ranks[lender][row]: position of lender in the order of row
+    array<array<uint8_t, ROW_COUNT>, ROW_COUNT> ranks{};
+    /// lenders[row][rank]: row at the position in the order of row
+    array<array<uint8_t, ROW_COUNT>, ROW_COUNT> lenders{};
+};
+
+/// Next value of the SplitMix64 generator
+constexpr uint64_t NextRandom(uint64_t& state) {
+    uint64_t value = (state += 0x9e3779b97f4a7c15ull);
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+    return value ^ (value >> 31);
+}
+
+/// Fixed seed, so band keys written to index files stay valid across runs
+constexpr LenderOrders MakeLenderOrders() {
+    LenderOrders result;
+    uint64_t state = 0x6d696e68617368ull;
+    for (size_t row = 0; row < ROW_COUNT; ++row) {
+        auto& order = result.lenders[row];
+        for (size_t rank = 0; rank < ROW_COUNT; ++rank) {
+            order[rank] = static_cast<uint8_t>(rank);
+        }
+        order[0] = static_cast<uint8_t>(row);
+        order[row] = 0;
+        // Fisher-Yates shuffle of all positions but the first
+        for (size_t rank = ROW_COUNT - 1; rank > 1; --rank) {
+            const size_t other = 1 + NextRandom(state) % rank;
+            const uint8_t lender = order[rank];
+            order[rank] = order[other];
+            order[other] = lender;
+        }
+        for (size_t rank = 0; rank < ROW_COUNT; ++rank) {
+            result.ranks[order[rank]][row] = static_cast<uint8_t>(rank);
+        }
+    }
+    return result;
+}
+
+constexpr LenderOrders LENDER_ORDERS = MakeLenderOrders();
+
+}  // namespace
+
+MinHashSignature::MinHashSignature() {
+    rows_.fill(EMPTY_ROW);
+}
+
+void MinHashSignature::Add(uint64_t element_hash) {
+    uint32_t& row = rows_[element_hash >> (64 - ROW_BITS)];
+    // The maximum marks an empty row, so it is never taken as a value
+    row = min(row, min(static_cast<uint32_t>(element_hash), EMPTY_ROW - 1));
+}
+
+BandKeys MinHashSignature::GetBandKeys() const {
+    // Every row takes the value of the first picked row in its order, itself if it is picked. Whether a row is picked
+    // is unpredictable, so the best rank of every row is the minimum over picked rows, found without branches.
+    array<uint8_t, ROW_COUNT> lenders;
+    size_t lender_count = 0;
+    for (size_t row = 0; row < ROW_COUNT; ++row) {
+        lenders[lender_count] = static_cast<uint8_t>(row);
+        lender_count += rows_[row] != EMPTY_ROW;
+    }
+    array<uint8_t, ROW_COUNT> best_ranks;
+    best_ranks.fill(ROW_COUNT - 1);
+    for (size_t i = 0; i < lender_count; ++i) {
+        const auto& ranks = LENDER_ORDERS.ranks[lenders[i]];
+        for (size_t row = 0; row < ROW_COUNT; ++row) {
+            best_ranks[row] = min(best_ranks[row], ranks[row]);
+        }
+    }
+    // Rows of the empty set stay empty whatever they take
+    array<uint32_t, ROW_COUNT> rows;
+    for (size_t row = 0; row < ROW_COUNT; ++row) {
+        rows[row] = rows_[LENDER_ORDERS.lenders[row][best_ranks[row]]];
+    }
+
+    BandKeys result;
+    for (size_t band = 0; band < MIN_HASH_BANDS; ++band) {
+        uint64_t key = band;
+        for (size_t row = band * MIN_HASH_BAND_ROWS; row < (band + 1) * MIN_HASH_BAND_ROWS; ++row) {
+            key = (key ^ rows[row]) * 0x9e3779b97f4a7c15ull;
+        }
+        result[band] = static_cast<uint32_t>(key >> 32);
+    }
+    return result;
+}
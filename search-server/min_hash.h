@@ -0,0 +1,36 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// MinHash signatures split into LSH bands. Two sets share the key of a band when all rows of the band are equal, which
+// happens with odds J^MIN_HASH_BAND_ROWS for sets with Jaccard similarity J, so similar sets share some key while
+// dissimilar ones rarely do.
+
+/// Bands of a signature
+constexpr const size_t MIN_HASH_BANDS = 16;
+/// Rows of a band. With 16 bands of 4 rows sets with similarity 0.8 share a key with odds 0.9998, with similarity 0.5
+/// with odds 0.64 and with similarity 0.3 with odds 0.12.
+constexpr const size_t MIN_HASH_BAND_ROWS = 4;
+
+/// Keys of the bands of a signature
+using BandKeys = std::array<uint32_t, MIN_HASH_BANDS>;
+
+/// MinHash signature of a set built one element at a time by one permutation hashing: the top bits of an element hash
+/// pick a row and its low bits compete for the minimum of the row, so adding an element takes constant time. A row no
+/// element picked copies the first picked row in a random order fixed per row (optimal densification), which keeps
+/// the odds of equal rows of two sets at their Jaccard similarity.
+class MinHashSignature {
+   public:
+    /// Signature of the empty set
+    MinHashSignature();
+
+    /// Adds an element given its hash, which must have well-mixed bits; adding an element twice changes nothing
+    void Add(uint64_t element_hash);
+
+    BandKeys GetBandKeys() const;
+
+   private:
+    std::array<uint32_t, MIN_HASH_BANDS * MIN_HASH_BAND_ROWS> rows_;
+};
@@ -0,0 +1,160 @@
+#include "posting_codec.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+uint8_t ByteLength(uint32_t value) {
+    return value < (1u << 8) ? 1 : value < (1u << 16) ? 2 : value < (1u << 24) ? 3 : 4;
+}
+
+size_t ControlBytesCount(size_t count) {
+    return (count + 3) / 4;
+}
+
+template <typename ValueAt>
+void EncodeValues(size_t count, ValueAt value_at, vector<uint8_t>& out) {
+    const size_t control_pos = out.size();
+    out.resize(control_pos + ControlBytesCount(count), 0);
+    for (size_t i = 0; i < count; ++i) {
+        const uint32_t value = value_at(i);
+        const uint8_t length = ByteLength(value);
+        out[control_pos + i / 4] |= static_cast<uint8_t>((length - 1) << (2 * (i % 4)));
+        for (uint8_t byte = 0; byte < length; ++byte) {
+            out.push_back(static_cast<uint8_t>(value >> (8 * byte)));
+        }
+    }
+}
+
+uint32_t DecodeValue(const uint8_t*& data, uint8_t code) {
+    uint32_t value = 0;
+    for (uint8_t byte = 0; byte <= code; ++byte) {
+        value |= static_cast<uint32_t>(*data++) << (8 * byte);
+    }
+    return value;
+}
+
+struct DecodeTables {
+    array<array<uint8_t, 16>, 256> shuffles{};
+    array<uint8_t, 256> lengths{};
+
+    constexpr DecodeTables() {
+        for (size_t control = 0; control < 256; ++control) {
+            uint8_t src = 0;
+            for (size_t i = 0; i < 4; ++i) {
+                const uint8_t length = ((control >> (2 * i)) & 3) + 1;
+                for (uint8_t byte = 0; byte < 4; ++byte) {
+                    // 0x80 makes the shuffle write zero
+                    shuffles[control][4 * i + byte] = byte < length ? src++ : 0x80;
+                }
+            }
+            lengths[control] = src;
+        }
+    }
+};
+
+constexpr DecodeTables DECODE_TABLES{};
+
+#if defined(__x86_64__)
+
+/// Decodes whole quads of values with SSSE3 shuffles, advancing data and base past them. Returns the number decoded.
+template <bool IsDelta>
+__attribute__((target("ssse3"))) size_t DecodeQuadsSsse3(const uint8_t* in, size_t count, uint32_t& base, const uint8_t*& data,
+                                                         uint32_t* out) {
+    size_t i = 0;
+    __m128i prev = _mm_set1_epi32(static_cast<int>(base));
+    for (; i + 4 <= count; i += 4) {
+        const uint8_t code = in[i / 4];
+        const __m128i shuffle = _mm_loadu_si128(reinterpret_cast<const __m128i*>(DECODE_TABLES.shuffles[code].data()));
+        __m128i values = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data)), shuffle);
+        data += DECODE_TABLES.lengths[code];
+        if constexpr (IsDelta) {
+            // Inclusive prefix sum of four lanes plus the last value of the previous quad
+            values = _mm_add_epi32(values, _mm_slli_si128(values, 4));
+            values = _mm_add_epi32(values, _mm_slli_si128(values, 8));
+            values = _mm_add_epi32(values, prev);
+            prev = _mm_shuffle_epi32(values, 0xFF);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), values);
+    }
+    if constexpr (IsDelta) {
+        base = static_cast<uint32_t>(_mm_cvtsi128_si32(prev));
+    }
+    return i;
+}
+
+#endif
+
+bool HasSsse3() {
+#if defined(__x86_64__)
+    static const bool has_ssse3 = __builtin_cpu_supports("ssse3");
+    return has_ssse3;
+#else
+    return false;
+#endif
+}
+
+template <bool IsDelta>
+const uint8_t* DecodeValues(const uint8_t* in, size_t count, uint32_t base, uint32_t* out) {
+    const uint8_t* data = in + ControlBytesCount(count);
+    size_t i = 0;
+#if defined(__x86_64__)
+    if (HasSsse3()) {
+        i = DecodeQuadsSsse3<IsDelta>(in, count, base, data, out);
+    }
+#endif
+
+    for (; i < count; ++i) {
+        const uint8_t code = (in[i / 4] >> (2 * (i % 4))) & 3;
+        const uint32_t value = DecodeValue(data, code);
+        if constexpr (IsDelta) {
+            base += value;
+            out[i] = base;
+        } else {
+            out[i] = value;
+        }
+    }
+
+    return data;
+}
+
+}  // namespace
+
+void EncodeStreamVByte(const uint32_t* values, size_t count, vector<uint8_t>& out) {
+    EncodeValues(
+        count,
+        [values](size_t i) {
+            return values[i];
+        },
+        out);
+}
+
+void EncodeStreamVByteDeltas(const uint32_t* values, size_t count, uint32_t base, vector<uint8_t>& out) {
+    EncodeValues(
+        count,
+        [values, base](size_t i) {
+            return values[i] - (i == 0 ? base : values[i - 1]);
+        },
+        out);
+}
+
+const uint8_t* DecodeStreamVByte(const uint8_t* in, size_t count, uint32_t* out) {
+    return DecodeValues<false>(in, count, 0, out);
+}
+
+const uint8_t* DecodeStreamVByteDeltas(const uint8_t* in, size_t count, uint32_t base, uint32_t* out) {
+    return DecodeValues<true>(in, count, base, out);
+}
+
+bool IsStreamVByteSimdEnabled() {
+    return HasSsse3();
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Stream VByte integer codec. Every four values share one control byte holding their byte lengths (1-4 bytes each),
+// all control bytes of a run go first and the value bytes follow. Decoding uses SSSE3 shuffles when the CPU supports
+// them, checked at run time, and falls back to scalar code otherwise.
+
+/// Decoders may read this many bytes past the end of the encoded data, so buffers must be padded with it
+constexpr const size_t STREAM_VBYTE_PADDING = 16;
+
+/// Appends count values to out
+void EncodeStreamVByte(const uint32_t* values, size_t count, std::vector<uint8_t>& out);
+
+/// Appends differences between neighbour values, the first one is taken relative to base.
+/// Values must not decrease.
+void EncodeStreamVByteDeltas(const uint32_t* values, size_t count, uint32_t base, std::vector<uint8_t>& out);
+
+/// Decodes count values written by EncodeStreamVByte. Returns position right after the encoded data.
+const uint8_t* DecodeStreamVByte(const uint8_t* in, size_t count, uint32_t* out);
+
+/// Decodes count values written by EncodeStreamVByteDeltas with the same base. Returns position right after the encoded data.
+const uint8_t* DecodeStreamVByteDeltas(const uint8_t* in, size_t count, uint32_t base, uint32_t* out);
+
+/// True if the CPU runs the vectorized decoder
+bool IsStreamVByteSimdEnabled();
@@ -1,17 +1,51 @@
 #include "process_queries.h"
 
 #include <execution>
+#include <iterator>
 #include <list>
 #include <string>
 #include <vector>
 
 #include "document.h"
+#include "query_executor.h"
 #include "search_server.h"
 
+namespace {
+
+QueryExecutor& GetDefaultExecutor() {
+    static QueryExecutor executor;
+    return executor;
+}
+
+}  // namespace
+
 std::vector<std::vector<Document>> ProcessQueries(const SearchServer& search_server, const std::vector<std::string>& queries) {
-    return ProcessQueries(std::execution::par, search_server, queries);
+    return ProcessQueries(GetDefaultExecutor(), search_server, queries);
 }
 
 std::list<Document> ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries) {
-    return ProcessQueriesJoined(std::execution::par, search_server, queries);
-}
\ No newline at end of file
+    return ProcessQueriesJoined(GetDefaultExecutor(), search_server, queries);
+}
+
+std::vector<std::vector<Document>> ProcessQueries(QueryExecutor& executor, const SearchServer& search_server,
+                                                  const std::vector<std::string>& queries) {
+    std::vector<std::vector<Document>> documents_lists(queries.size());
+    if (queries.size() >= executor.GetWorkerCount()) {
+        executor.ParallelFor(queries.size(), [&](size_t i) {
+            documents_lists[i] = search_server.FindTopDocuments(std::execution::seq, queries[i]);
+        });
+    } else {
+        executor.ParallelFor(queries.size(), [&](size_t i) {
+            documents_lists[i] = search_server.FindTopDocuments(ExecutorPolicy{executor}, queries[i]);
+        });
+    }
+    return documents_lists;
+}
+
+std::list<Document> ProcessQueriesJoined(QueryExecutor& executor, const SearchServer& search_server, const std::vector<std::string>& queries) {
+    std::list<Document> documents;
+    for (auto& documents_list : ProcessQueries(executor, search_server, queries)) {
+        documents.insert(documents.end(), std::make_move_iterator(documents_list.begin()), std::make_move_iterator(documents_list.end()));
+    }
+    return documents;
+}
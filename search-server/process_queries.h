@@ -8,12 +8,21 @@
 #include <vector>
 
 #include "document.h"
+#include "query_executor.h"
 #include "search_server.h"
 
+/// Runs the queries on a process-wide QueryExecutor with a worker per core
 std::vector<std::vector<Document>> ProcessQueries(const SearchServer& search_server, const std::vector<std::string>& queries);
 
 std::list<Document> ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries);
 
+/// Runs the queries on the workers of executor. A batch that keeps every worker busy runs each query sequentially,
+/// a smaller one splits its queries into ordinal ranges that the idle workers steal, so no threads run outside the pool.
+std::vector<std::vector<Document>> ProcessQueries(QueryExecutor& executor, const SearchServer& search_server,
+                                                  const std::vector<std::string>& queries);
+
+std::list<Document> ProcessQueriesJoined(QueryExecutor& executor, const SearchServer& search_server, const std::vector<std::string>& queries);
+
 template <typename ExecutionPolicy>
 std::vector<std::vector<Document>> ProcessQueries(ExecutionPolicy&& policy, const SearchServer& search_server,
                                                   const std::vector<std::string>& queries) {
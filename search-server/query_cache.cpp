@@ -0,0 +1,83 @@
+#include "query_cache.h"
+
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "document.h"
+
+using namespace std;
+
+QueryCache::QueryCache(size_t capacity) : capacity_{capacity} {}
+
+QueryCache::QueryCache(const QueryCache& other) : capacity_{other.capacity_.load()} {}
+
+QueryCache& QueryCache::operator=(const QueryCache& other) {
+    if (this != &other) {
+        lock_guard guard(mutex_);
+        capacity_ = other.capacity_.load();
+        positions_.clear();
+        entries_.clear();
+        statistics_ = {};
+    }
+    return *this;
+}
+
+void QueryCache::SetCapacity(size_t capacity) {
+    lock_guard guard(mutex_);
+    capacity_ = capacity;
+    EvictOverCapacity();
+}
+
+optional<vector<Document>> QueryCache::Find(const string& key, uint64_t generation) {
+    lock_guard guard(mutex_);
+    const auto position = positions_.find(key);
+    if (position == positions_.end()) {
+        ++statistics_.misses;
+        return nullopt;
+    }
+    const auto entry = position->second;
+    if (entry->generation != generation) {
+        Erase(entry);
+        ++statistics_.invalidations;
+        ++statistics_.misses;
+        return nullopt;
+    }
+    entries_.splice(entries_.begin(), entries_, entry);
+    ++statistics_.hits;
+    return entry->documents;
+}
+
+void QueryCache::Insert(const string& key, uint64_t generation, const vector<Document>& documents) {
+    lock_guard guard(mutex_);
+    if (capacity_ == 0) {
+        return;
+    }
+    // A concurrent miss of the same query may have inserted it already
+    const auto position = positions_.find(key);
+    if (position != positions_.end()) {
+        Erase(position->second);
+    }
+    entries_.push_front({key, generation, documents});
+    positions_.emplace(entries_.front().key, entries_.begin());
+    EvictOverCapacity();
+}
+
+QueryCache::Statistics QueryCache::GetStatistics() const {
+    lock_guard guard(mutex_);
+    return statistics_;
+}
+
+void QueryCache::Erase(list<Entry>::iterator entry) {
+    positions_.erase(entry->key);
+    entries_.erase(entry);
+}
+
+void QueryCache::EvictOverCapacity() {
+    while (entries_.size() > capacity_) {
+        Erase(prev(entries_.end()));
+        ++statistics_.evictions;
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "document.h"
+
+/// Bounded LRU cache of search results, safe to use from concurrent queries.
+///
+/// Every entry remembers the generation of the index it was computed for; a lookup with a newer generation drops it,
+/// so mutations invalidate the whole cache by bumping the generation without touching it.
+class QueryCache {
+   public:
+    struct Statistics {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        /// Entries dropped to make room for new ones
+        uint64_t evictions = 0;
+        /// Entries dropped because the index changed
+        uint64_t invalidations = 0;
+
+        double GetHitRate() const {
+            return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(hits + misses);
+        }
+    };
+
+    /// Cache of at most capacity entries; zero capacity disables it
+    explicit QueryCache(size_t capacity = 0);
+
+    /// A copy serves another index, so it takes only the capacity
+    QueryCache(const QueryCache& other);
+    QueryCache& operator=(const QueryCache& other);
+
+    bool IsEnabled() const {
+        return capacity_.load(std::memory_order_relaxed) > 0;
+    }
+
+    /// Evicts the least recently used entries beyond capacity
+    void SetCapacity(size_t capacity);
+
+    /// Results cached for key at generation
+    std::optional<std::vector<Document>> Find(const std::string& key, uint64_t generation);
+
+    void Insert(const std::string& key, uint64_t generation, const std::vector<Document>& documents);
+
+    Statistics GetStatistics() const;
+
+   private:
+    struct Entry {
+        std::string key;
+        uint64_t generation = 0;
+        std::vector<Document> documents;
+    };
+
+    std::atomic_size_t capacity_;
+    mutable std::mutex mutex_;
+    /// Most recently used first
+    std::list<Entry> entries_;
+    /// Keys are views of the keys of entries
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> positions_;
+    Statistics statistics_;
+
+    void Erase(std::list<Entry>::iterator entry);
+
+    void EvictOverCapacity();
+};
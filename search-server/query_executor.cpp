@@ -0,0 +1,164 @@
+#include "query_executor.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+thread_local const QueryExecutor* QueryExecutor::current_executor_ = nullptr;
+thread_local size_t QueryExecutor::current_worker_index_ = 0;
+
+QueryExecutor::QueryExecutor(size_t worker_count, bool pin_to_cores) {
+    if (worker_count == 0) {
+        throw invalid_argument("Query executor needs at least one worker"s);
+    }
+    workers_.reserve(worker_count);
+    for (size_t i = 0; i < worker_count; ++i) {
+        workers_.push_back(make_unique<Worker>());
+    }
+    const size_t core_count = max(1u, thread::hardware_concurrency());
+    for (size_t i = 0; i < worker_count; ++i) {
+        workers_[i]->thread = thread([this, i]() {
+            RunWorker(i);
+        });
+        if (pin_to_cores) {
+            cpu_set_t cores;
+            CPU_ZERO(&cores);
+            CPU_SET(i % core_count, &cores);
+            pthread_setaffinity_np(workers_[i]->thread.native_handle(), sizeof(cores), &cores);
+        }
+    }
+}
+
+QueryExecutor::~QueryExecutor() {
+    {
+        lock_guard guard(sleep_mutex_);
+        is_stopping_ = true;
+    }
+    sleep_condition_.notify_all();
+    for (auto& worker : workers_) {
+        worker->thread.join();
+    }
+}
+
+void QueryExecutor::Submit(vector<Task> tasks) {
+    const size_t task_count = tasks.size();
+    if (IsWorkerThread()) {
+        Worker& worker = *workers_[current_worker_index_];
+        lock_guard guard(worker.mutex);
+        for (Task& task : tasks) {
+            worker.tasks.push_back(move(task));
+        }
+    } else {
+        for (size_t i = 0; i < task_count; ++i) {
+            Worker& worker = *workers_[i % workers_.size()];
+            lock_guard guard(worker.mutex);
+            worker.tasks.push_back(move(tasks[i]));
+        }
+    }
+    {
+        // Counting under the sleep mutex keeps a worker from missing the wakeup between its check and its wait
+        lock_guard guard(sleep_mutex_);
+        queued_task_count_ += task_count;
+    }
+    sleep_condition_.notify_all();
+}
+
+bool QueryExecutor::TryTakeTask(size_t worker_index, Task& task) {
+    {
+        Worker& worker = *workers_[worker_index];
+        lock_guard guard(worker.mutex);
+        if (!worker.tasks.empty()) {
+            task = move(worker.tasks.back());
+            worker.tasks.pop_back();
+            --queued_task_count_;
+            return true;
+        }
+    }
+    for (size_t offset = 1; offset < workers_.size(); ++offset) {
+        Worker& victim = *workers_[(worker_index + offset) % workers_.size()];
+        lock_guard guard(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = move(victim.tasks.front());
+            victim.tasks.pop_front();
+            --queued_task_count_;
+            return true;
+        }
+    }
+    return false;
+}
+
+void QueryExecutor::RunWorker(size_t worker_index) {
+    current_executor_ = this;
+    current_worker_index_ = worker_index;
+    Task task;
+    while (true) {
+        if (TryTakeTask(worker_index, task)) {
+            task();
+            continue;
+        }
+        unique_lock lock(sleep_mutex_);
+        sleep_condition_.wait(lock, [this]() {
+            return is_stopping_ || queued_task_count_ > 0;
+        });
+        if (is_stopping_ && queued_task_count_ == 0) {
+            return;
+        }
+    }
+}
+
+void QueryExecutor::FinishChunk(Job& job, exception_ptr error) {
+    // The job lives on the stack of ParallelFor, so it is touched only under its mutex
+    {
+        lock_guard guard(job.mutex);
+        if (error && !job.error) {
+            job.error = error;
+        }
+        if (--job.pending_chunk_count > 0) {
+            return;
+        }
+        job.done_condition.notify_all();
+    }
+    // A worker waiting for the job sleeps on the pool condition; taking its mutex orders the wakeup after its check
+    {
+        lock_guard guard(sleep_mutex_);
+    }
+    sleep_condition_.notify_all();
+}
+
+bool QueryExecutor::IsDone(Job& job) {
+    lock_guard guard(job.mutex);
+    return job.pending_chunk_count == 0;
+}
+
+void QueryExecutor::Wait(Job& job) {
+    if (!IsWorkerThread()) {
+        unique_lock lock(job.mutex);
+        job.done_condition.wait(lock, [&job]() {
+            return job.pending_chunk_count == 0;
+        });
+        return;
+    }
+
+    // A blocked worker would leave its core idle, so it runs tasks until the job is over. With nothing to run, the
+    // remaining chunks are running on other workers, and it sleeps until one of them finishes the job or queues more.
+    Task task;
+    while (!IsDone(job)) {
+        if (TryTakeTask(current_worker_index_, task)) {
+            task();
+            continue;
+        }
+        unique_lock lock(sleep_mutex_);
+        sleep_condition_.wait(lock, [this, &job]() {
+            return queued_task_count_ > 0 || IsDone(job);
+        });
+    }
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Work-stealing thread pool for batches of queries.
+///
+/// Every worker has a deque of tasks: it takes its own tasks from the back and steals from the front of the others
+/// when it runs out. ParallelFor may be called from inside a task; the calling worker then runs the nested tasks
+/// itself and helps the others instead of blocking, so nesting never adds threads to the pool. A search given
+/// ExecutorPolicy runs its ordinal ranges this way.
+class QueryExecutor {
+   public:
+    /// Starts worker_count workers. With pin_to_cores worker i runs only on core i modulo the core count.
+    explicit QueryExecutor(size_t worker_count = std::max(1u, std::thread::hardware_concurrency()), bool pin_to_cores = false);
+
+    QueryExecutor(const QueryExecutor&) = delete;
+    QueryExecutor& operator=(const QueryExecutor&) = delete;
+
+    /// Waits for the queued tasks and stops the workers
+    ~QueryExecutor();
+
+    size_t GetWorkerCount() const {
+        return workers_.size();
+    }
+
+    /// Whether the current thread is a worker of this executor
+    bool IsWorkerThread() const {
+        return current_executor_ == this;
+    }
+
+    /// Calls function(i) for every i in [0, count) on the workers and waits for all calls.
+    /// Rethrows the first exception thrown by a call; the other calls still run.
+    template <typename Function>
+    void ParallelFor(size_t count, Function function);
+
+   private:
+    /// Chunks per worker: enough for stealing to even out queries of different cost
+    static constexpr size_t CHUNKS_PER_WORKER = 4;
+
+    /// Calls of one ParallelFor
+    struct Job {
+        std::mutex mutex;
+        std::condition_variable done_condition;
+        size_t pending_chunk_count = 0;
+        std::exception_ptr error;
+    };
+
+    using Task = std::function<void()>;
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    /// Tasks queued in all deques, workers sleep while it is zero
+    std::atomic_size_t queued_task_count_ = 0;
+    std::mutex sleep_mutex_;
+    /// Notified when tasks are queued and when a job finishes
+    std::condition_variable sleep_condition_;
+    bool is_stopping_ = false;
+
+    /// Executor and index of the worker running the current thread
+    static thread_local const QueryExecutor* current_executor_;
+    static thread_local size_t current_worker_index_;
+
+    /// Queues tasks on the current worker, or spreads them over all workers when called outside of the pool
+    void Submit(std::vector<Task> tasks);
+
+    /// Takes a task of worker_index or steals one from another worker
+    bool TryTakeTask(size_t worker_index, Task& task);
+
+    void RunWorker(size_t worker_index);
+
+    void FinishChunk(Job& job, std::exception_ptr error);
+
+    static bool IsDone(Job& job);
+
+    /// Blocks until every chunk of job finished. A worker runs queued tasks meanwhile and sleeps when there are none.
+    void Wait(Job& job);
+};
+
+template <typename Function>
+void QueryExecutor::ParallelFor(size_t count, Function function) {
+    if (count == 0) {
+        return;
+    }
+    const size_t chunk_count = std::min(count, workers_.size() * CHUNKS_PER_WORKER);
+    Job job;
+    job.pending_chunk_count = chunk_count;
+
+    std::vector<Task> tasks;
+    tasks.reserve(chunk_count);
+    for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+        const size_t begin = count * chunk / chunk_count;
+        const size_t end = count * (chunk + 1) / chunk_count;
+        tasks.push_back([this, &job, &function, begin, end]() {
+            std::exception_ptr error;
+            for (size_t i = begin; i < end; ++i) {
+                try {
+                    function(i);
+                } catch (...) {
+                    error = std::current_exception();
+                }
+            }
+            FinishChunk(job, error);
+        });
+    }
+    Submit(std::move(tasks));
+    Wait(job);
+
+    if (job.error) {
+        std::rethrow_exception(job.error);
+    }
+}
+
+/// Execution policy of searches whose ordinal ranges run as tasks of executor, see SearchServer::FindTopDocuments
+struct ExecutorPolicy {
+    QueryExecutor& executor;
+};
@@ -0,0 +1,108 @@
+#include "request_queue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+constexpr const uint64_t NO_RESULT_FLAG = uint64_t{1} << 31;
+constexpr const uint64_t MAX_LATENCY = NO_RESULT_FLAG - 1;
+
+uint64_t GetTicketBits(uint64_t entry) {
+    return entry >> 32;
+}
+
+uint64_t GetNoResult(uint64_t entry) {
+    return (entry & NO_RESULT_FLAG) != 0 ? 1 : 0;
+}
+
+uint64_t GetLatency(uint64_t entry) {
+    return entry & MAX_LATENCY;
+}
+
+/// Whether the slot holds a request younger than entry, whose writer was overtaken by a whole lap of the ring
+bool IsNewer(uint64_t slot_entry, uint64_t entry) {
+    return slot_entry != 0 && static_cast<int32_t>(GetTicketBits(slot_entry) - GetTicketBits(entry)) > 0;
+}
+
+}  // namespace
+
+RequestQueue::RequestQueue(const SearchServer& search_server, size_t capacity, bool keep_queries)
+    : server_{search_server}, capacity_{capacity}, entries_{new atomic_uint64_t[capacity]{}} {
+    if (capacity == 0) {
+        throw invalid_argument("Request queue capacity must be positive"s);
+    }
+    if (keep_queries) {
+        query_slots_.reset(new QuerySlot[capacity]);
+    }
+}
+
+int RequestQueue::GetNoResultRequests() const {
+    return static_cast<int>(no_result_count_.load(memory_order_relaxed));
+}
+
+size_t RequestQueue::GetRequestCount() const {
+    return static_cast<size_t>(min<uint64_t>(next_ticket_.load(memory_order_relaxed), capacity_));
+}
+
+chrono::microseconds RequestQueue::GetAverageLatency() const {
+    const size_t count = GetRequestCount();
+    return chrono::microseconds(count == 0 ? 0 : latency_sum_.load(memory_order_relaxed) / count);
+}
+
+vector<string> RequestQueue::GetQueries() const {
+    vector<string> result;
+    if (!query_slots_) {
+        return result;
+    }
+    const uint64_t next_ticket = next_ticket_.load(memory_order_relaxed);
+    const uint64_t first_ticket = next_ticket - GetRequestCount();
+    for (uint64_t ticket = first_ticket; ticket < next_ticket; ++ticket) {
+        QuerySlot& slot = query_slots_[ticket % capacity_];
+        lock_guard guard(slot.mutex);
+        // A request still running has not written its query yet
+        if (slot.ticket == ticket + 1) {
+            result.push_back(slot.raw_query);
+        }
+    }
+    return result;
+}
+
+uint64_t RequestQueue::MakeEntry(uint64_t ticket, bool is_no_result, chrono::steady_clock::duration latency) {
+    const auto microseconds = static_cast<uint64_t>(max<int64_t>(chrono::duration_cast<chrono::microseconds>(latency).count(), 0));
+    return ((ticket + 1) & 0xffffffffull) << 32 | (is_no_result ? NO_RESULT_FLAG : 0) | min(microseconds, MAX_LATENCY);
+}
+
+void RequestQueue::Record(const string& raw_query, size_t result_count, chrono::steady_clock::duration latency) {
+    const uint64_t ticket = next_ticket_.fetch_add(1, memory_order_relaxed);
+    const uint64_t entry = MakeEntry(ticket, result_count == 0, latency);
+    atomic_uint64_t& slot = entries_[ticket % capacity_];
+    uint64_t expired = slot.load(memory_order_relaxed);
+    do {
+        if (IsNewer(expired, entry)) {
+            return;
+        }
+    } while (!slot.compare_exchange_weak(expired, entry, memory_order_relaxed));
+
+    // Every entry leaves its slot exactly once, so the counters always match the entries held by the slots;
+    // unsigned wrap-around makes adding the difference exact
+    no_result_count_.fetch_add(GetNoResult(entry) - GetNoResult(expired), memory_order_relaxed);
+    latency_sum_.fetch_add(GetLatency(entry) - GetLatency(expired), memory_order_relaxed);
+
+    if (query_slots_) {
+        QuerySlot& query_slot = query_slots_[ticket % capacity_];
+        lock_guard guard(query_slot.mutex);
+        if (query_slot.ticket < ticket + 1) {
+            query_slot.ticket = ticket + 1;
+            query_slot.raw_query = raw_query;
+        }
+    }
+}
@@ -1,57 +1,79 @@
 #pragma once
+#include <atomic>
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
-#include <queue>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "search_server.h"
 
+/// Statistics of the most recent requests to a search server, one request per minute of a day by default.
+///
+/// AddFindRequest may be called from any number of threads without a global lock: every request takes the next
+/// ticket of a fixed ring of slots and swaps its entry into the slot of the ticket, and counters of the window are
+/// adjusted by the difference between the new entry and the expired one it replaces.
 class RequestQueue {
    public:
-    explicit RequestQueue(const SearchServer& search_server) : server_{search_server}, server_time_{0} {}
+    static constexpr size_t MIN_IN_DAY = 24 * 60;
+
+    /// Raw queries are kept only with keep_queries, since copying them is most of the cost of a request
+    explicit RequestQueue(const SearchServer& search_server, size_t capacity = MIN_IN_DAY, bool keep_queries = false);
 
     template <typename DocumentPredicate = std::function<bool(int, DocumentStatus, int)>>
     std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate) {
-        if (server_time_ < min_in_day_) {
-            server_time_ += std::chrono::minutes(1);
-        } else {
-            requests_.pop_front();
-        }
-
-        const auto& found_docs = server_.FindTopDocuments(raw_query, document_predicate);
-
-        requests_.push_back(QueryResult{server_time_, found_docs.size(), raw_query});
+        const auto start = std::chrono::steady_clock::now();
+        auto found_docs = server_.FindTopDocuments(raw_query, document_predicate);
+        Record(raw_query, found_docs.size(), std::chrono::steady_clock::now() - start);
         return found_docs;
     }
 
+    /// Served from the query cache of the server when it is enabled
     std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentStatus status) {
-        return AddFindRequest(raw_query, [status]([[maybe_unused]] int id, DocumentStatus doc_status, [[maybe_unused]] int rating) {
-            return doc_status == status;
-        });
+        const auto start = std::chrono::steady_clock::now();
+        auto found_docs = server_.FindTopDocuments(raw_query, status);
+        Record(raw_query, found_docs.size(), std::chrono::steady_clock::now() - start);
+        return found_docs;
     }
 
     std::vector<Document> AddFindRequest(const std::string& raw_query) {
         return AddFindRequest(raw_query, DocumentStatus::ACTUAL);
     }
 
-    int GetNoResultRequests() const {
-        int result = count_if(requests_.begin(), requests_.end(), [](QueryResult res) {
-            return res.response_documents_count == 0;
-        });
-        return result;
-    }
+    /// Requests of the window that found nothing
+    int GetNoResultRequests() const;
+
+    /// Requests in the window
+    size_t GetRequestCount() const;
+
+    /// Mean time FindTopDocuments took for requests of the window
+    std::chrono::microseconds GetAverageLatency() const;
+
+    /// Raw queries of the window, oldest first; empty unless the queue keeps them
+    std::vector<std::string> GetQueries() const;
 
    private:
-    struct QueryResult {
-        std::chrono::minutes time;
-        size_t response_documents_count;
+    /// Raw query of the request with ticket, kept by a slot
+    struct QuerySlot {
+        std::mutex mutex;
+        uint64_t ticket = 0;
         std::string raw_query;
-
-        QueryResult(std::chrono::minutes time, size_t response_documents_count, std::string raw_query)
-            : time{time}, response_documents_count{response_documents_count}, raw_query{raw_query} {}
     };
-    std::deque<QueryResult> requests_;
-    constexpr const static std::chrono::minutes min_in_day_{std::chrono::hours(24)};
+
     const SearchServer& server_;
-    std::chrono::minutes server_time_;
+    size_t capacity_;
+    /// Entry of every slot packed into one word, see MakeEntry; zero for a slot never used
+    std::unique_ptr<std::atomic_uint64_t[]> entries_;
+    std::unique_ptr<QuerySlot[]> query_slots_;
+    std::atomic_uint64_t next_ticket_{0};
+    std::atomic_uint64_t no_result_count_{0};
+    std::atomic_uint64_t latency_sum_{0};
+
+    /// Low 32 bits of ticket plus one, the no result flag and the latency in microseconds, saturated to 31 bits
+    static uint64_t MakeEntry(uint64_t ticket, bool is_no_result, std::chrono::steady_clock::duration latency);
+
+    void Record(const std::string& raw_query, size_t result_count, std::chrono::steady_clock::duration latency);
 };
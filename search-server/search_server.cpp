@@ -3,16 +3,20 @@
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <exception>
 #include <iostream>
 #include <iterator>
 #include <map>
+#include <memory>
 #include <numeric>
+#include <optional>
 #include <set>
 #include <stdexcept>
 #include <string>
 #include <string_view>
 #include <vector>
 
+#include "index_file.h"
 #include "string_processing.h"
 
 using namespace std;
@@ -21,50 +25,122 @@ using namespace std;
 // SearchServer implementation
 // ----------------------------------------------------------------
 
-SearchServer::SearchServer(const string_view stop_words_text) : SearchServer(SplitIntoWords(stop_words_text)) {}
+SearchServer::SearchServer(const string_view stop_words_text) {
+    ForEachWord(stop_words_text, [this](const string_view word) {
+        stop_words_.emplace(word);
+    });
+    InternStopWords();
+}
+
+SearchServer::SearchServer(const string& stop_words_text) : SearchServer(static_cast<string_view>(stop_words_text)) {}
+
+namespace {
+
+/// Hash of a fixed word taken the way the dictionary and content hashes take it
+uint64_t ComputeHashProbe() {
+    return hash<string_view>{}("search server index"sv);
+}
 
-SearchServer::SearchServer(const string& stop_words_text) : SearchServer(SplitIntoWords(stop_words_text)) {}
+/// Spreads the bits of a word hash (the SplitMix64 finalizer), so that sums over different word sets rarely collide
+uint64_t MixWordHash(uint64_t hash) {
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+    return hash ^ (hash >> 31);
+}
+
+}  // namespace
 
 void SearchServer::AddDocument(int document_id, const string_view document, DocumentStatus status, const vector<int>& ratings) {
-    if ((document_id < 0) || (documents_.count(document_id) > 0)) {
+    if ((document_id < 0) || (FindDocument(document_id) != nullptr)) {
         throw invalid_argument("Invalid document_id"s);
     }
-    const auto words = SplitIntoWordsNoStop(document);
+    ParsedDocument parsed_document;
+    {
+        StageTimer timer(Stage::ADD_PARSE);
+        parsed_document = ParseDocument(document);
+        if (parsed_document.error) {
+            rethrow_exception(parsed_document.error);
+        }
+        ComputeFingerprints(parsed_document);
+        if (const exception_ptr error = CheckDuplicate(parsed_document.content_hash)) {
+            rethrow_exception(error);
+        }
+    }
+    Detach();
+    StageTimer index_timer(Stage::ADD_INDEX);
+    for (const string_view word : parsed_document.new_words) {
+        parsed_document.terms.push_back(terms_.Intern(word));
+    }
+    const size_t word_count = parsed_document.terms.size();
+    auto document_terms = MakeDocumentTerms(move(parsed_document.terms));
 
-    const double inv_word_count = 1.0 / words.size();
-    auto& words_container = document_to_words_freqs_[document_id];
-    string hash_sep = ""s;
-    std::for_each(words.cbegin(), words.cend(), [&](const string_view word) {
-        const auto ptr = word_to_document_freqs_.emplace(word, map<int, double>{}).first;
-        double& curr_freq = ptr->second[document_id];
-        curr_freq += inv_word_count;
-        words_container.insert({ptr->first, curr_freq});
-    });
-    documents_.emplace(document_id, DocumentData{ComputeAverageRating(ratings), status});
-    document_ids_.push_back(document_id);
+    const auto ordinal = static_cast<DocumentOrdinal>(documents_.size());
+    inverted_index_.SetDocumentLength(ordinal, word_count);
+    for (const auto [term, term_freq] : document_terms) {
+        inverted_index_.Add(term, ordinal, term_freq);
+    }
+    AppendDocumentTerms(document_terms);
+    documents_.Mutable().push_back({document_id, ComputeAverageRating(ratings), status});
+    document_band_keys_.Mutable().push_back(parsed_document.band_keys);
+    InsertDocumentId(document_id, ordinal);
+    AddContentHash(parsed_document.content_hash, document_id);
+    index_timer.Stop();
+
+    StageTimer statistics_timer(Stage::ADD_STATISTICS);
+    if (log_document_freqs_.size() < terms_.Size()) {
+        log_document_freqs_.Mutable().resize(terms_.Size());
+    }
+    for (const TermFreq& word : document_terms) {
+        UpdateTermStatistics(word.term);
+    }
+    log_document_count_ = log(static_cast<double>(GetDocumentCount()));
+    ++generation_;
+}
 
-    auto hash = BuildHash<double>(words_container, {}, ","s);
-    hash_content_[hash].insert(document_id);
+void SearchServer::AddDocuments(const vector<NewDocument>& documents) {
+    AddDocuments(std::execution::seq, documents);
 }
 
 vector<Document> SearchServer::FindTopDocuments(const string_view raw_query) const {
     return FindTopDocuments(std::execution::seq, raw_query);
 }
 
-vector<Document> SearchServer::FindTopDocuments(const string_view raw_query, DocumentStatus status) const {
-    return FindTopDocuments(std::execution::seq, raw_query, status);
+vector<Document> SearchServer::FindTopDocuments(const string_view raw_query, DocumentStatus status, size_t max_count) const {
+    return FindTopDocuments(std::execution::seq, raw_query, status, max_count);
+}
+
+SearchServer::PreparedQuery SearchServer::PrepareQuery(const string_view raw_query) const {
+    PreparedQuery result;
+    ForEachCheckedWord(raw_query, [this, &result](const string_view word, bool is_valid) {
+        const auto query_word = ParseQueryWord(word, is_valid);
+        if (query_word.is_stop) {
+            return;
+        }
+        if (query_word.term == NO_TERM) {
+            (query_word.is_minus ? result.unknown_minus_words_ : result.unknown_plus_words_).emplace_back(query_word.data);
+        } else {
+            (query_word.is_minus ? result.query_.minus_words : result.query_.plus_words).push_back(query_word.term);
+        }
+    });
+    result.query_.MakeUnique();
+    result.term_count_ = terms_.Size();
+    return result;
+}
+
+vector<Document> SearchServer::FindTopDocuments(const PreparedQuery& query, DocumentStatus status, size_t max_count) const {
+    return FindTopDocuments(std::execution::seq, query, status, max_count);
 }
 
 int SearchServer::GetDocumentCount() const {
-    return documents_.size();
+    return document_count_;
 }
 
 SearchServer::IdsConstIterator SearchServer::begin() const {
-    return document_ids_.begin();
+    return {documents_.begin(), documents_.end()};
 }
 
 SearchServer::IdsConstIterator SearchServer::end() const {
-    return document_ids_.end();
+    return {documents_.end(), documents_.end()};
 }
 
 set<std::string, std::less<>> SearchServer::SearchServer::GetStopWords() const {
@@ -75,48 +151,470 @@ tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(const str
     return MatchDocument(std::execution::seq, raw_query, document_id);
 }
 
+tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(const PreparedQuery& query, int document_id) const {
+    return MatchDocument(std::execution::seq, query, document_id);
+}
+
 const map<string_view, double>& SearchServer::GetWordFrequencies(int document_id) const {
     static const map<string_view, double> invalid_result{};
-    if (document_to_words_freqs_.empty() || !document_to_words_freqs_.count(document_id)) {
+    const DocumentIdOrdinal* document = FindDocument(document_id);
+    if (document == nullptr) {
         return invalid_result;
     }
 
-    return document_to_words_freqs_.at(document_id);
+    return word_frequencies_.Get(document_id, [this, document]() {
+        map<string_view, double> result;
+        for (const auto [term, term_freq] : GetDocumentTerms(document->ordinal)) {
+            result.emplace(terms_.GetTerm(term), term_freq);
+        }
+        return result;
+    });
 }
 
 void SearchServer::RemoveDocument(int document_id) {
     RemoveDocument(std::execution::seq, document_id);
 }
 
+void SearchServer::RemoveDocuments(const vector<int>& document_ids) {
+    RemoveDocuments(std::execution::seq, document_ids);
+}
+
 void SearchServer::RemoveDuplicates() {
-    for (auto& [_, ids] : hash_content_) {
-        if (ids.empty() || ids.size() == 1) {
-            continue;
+    RemoveDuplicates(std::execution::seq);
+}
+
+optional<int> SearchServer::FindDuplicate(int document_id) const {
+    const DocumentIdOrdinal* document = FindDocument(document_id);
+    if (document == nullptr) {
+        return nullopt;
+    }
+    return FindContentHash(ComputeContentHash(GetDocumentTerms(document->ordinal)), document_id);
+}
+
+void SearchServer::SetDuplicatePolicy(DuplicatePolicy policy) {
+    duplicate_policy_ = policy;
+}
+
+vector<vector<int>> SearchServer::FindNearDuplicates(double min_similarity) const {
+    return FindNearDuplicates(std::execution::seq, min_similarity);
+}
+
+void SearchServer::RemoveNearDuplicates(double min_similarity) {
+    RemoveNearDuplicates(std::execution::seq, min_similarity);
+}
+
+void SearchServer::PurgeRemovedDocuments() {
+    if (pending_removal_count_ == 0) {
+        return;
+    }
+    Detach();
+    // Present documents keep their order, so ordinals only move down and posting lists stay sorted
+    vector<DocumentOrdinal> new_ordinals(documents_.size(), NO_ORDINAL);
+    DocumentOrdinal ordinal_count = 0;
+    for (size_t ordinal = 0; ordinal < documents_.size(); ++ordinal) {
+        if (!documents_[ordinal].is_removed) {
+            new_ordinals[ordinal] = ordinal_count++;
+        }
+    }
+    inverted_index_.Purge(new_ordinals);
+
+    // The forward index is compacted in place: a document never moves past its old position
+    auto& documents = documents_.Mutable();
+    auto& document_terms = document_terms_.Mutable();
+    auto& document_term_ends = document_term_ends_.Mutable();
+    auto& document_band_keys = document_band_keys_.Mutable();
+    size_t terms_begin = 0;
+    size_t kept_terms_end = 0;
+    for (size_t ordinal = 0; ordinal < documents.size(); ++ordinal) {
+        const size_t terms_end = document_term_ends[ordinal];
+        if (const DocumentOrdinal new_ordinal = new_ordinals[ordinal]; new_ordinal != NO_ORDINAL) {
+            copy(document_terms.begin() + terms_begin, document_terms.begin() + terms_end, document_terms.begin() + kept_terms_end);
+            kept_terms_end += terms_end - terms_begin;
+            document_term_ends[new_ordinal] = kept_terms_end;
+            documents[new_ordinal] = documents[ordinal];
+            document_band_keys[new_ordinal] = document_band_keys[ordinal];
+        }
+        terms_begin = terms_end;
+    }
+    documents.resize(ordinal_count);
+    documents.shrink_to_fit();
+    document_terms.resize(kept_terms_end);
+    document_terms.shrink_to_fit();
+    document_term_ends.resize(ordinal_count);
+    document_term_ends.shrink_to_fit();
+    document_band_keys.resize(ordinal_count);
+    document_band_keys.shrink_to_fit();
+
+    auto& id_ordinals = id_ordinals_.Mutable();
+    id_ordinals.erase(remove_if(id_ordinals.begin(), id_ordinals.end(),
+                                [&new_ordinals](const DocumentIdOrdinal& item) {
+                                    return new_ordinals[item.ordinal] == NO_ORDINAL;
+                                }),
+                      id_ordinals.end());
+    for (DocumentIdOrdinal& item : id_ordinals) {
+        item.ordinal = new_ordinals[item.ordinal];
+    }
+    pending_removal_count_ = 0;
+}
+
+size_t SearchServer::GetPendingRemovalCount() const {
+    return pending_removal_count_;
+}
+
+void SearchServer::CompressIndex() {
+    inverted_index_.Compress();
+}
+
+size_t SearchServer::GetIndexMemoryUsage() const {
+    return inverted_index_.MemoryUsage();
+}
+
+void SearchServer::SaveIndex(const string& path) const {
+    if (pending_removal_count_ > 0) {
+        SearchServer purged = *this;
+        purged.PurgeRemovedDocuments();
+        purged.SaveIndex(path);
+        return;
+    }
+
+    IndexFileWriter writer;
+    writer.AddSection(IndexSection::METADATA, vector<IndexMetadata>{{stop_words_.size(), ComputeHashProbe()}});
+    terms_.Save(writer);
+    inverted_index_.Save(writer);
+    writer.AddSection(IndexSection::DOCUMENT_TERM_ENDS, document_term_ends_);
+    writer.AddSection(IndexSection::DOCUMENT_TERMS, document_terms_);
+    writer.AddSection(IndexSection::DOCUMENTS, documents_);
+    writer.AddSection(IndexSection::DOCUMENT_ID_ORDINALS, id_ordinals_);
+    if (!mapped_content_hashes_.empty()) {
+        writer.AddSection(IndexSection::CONTENT_HASHES, mapped_content_hashes_);
+    } else {
+        vector<ContentHash> content_hashes;
+        content_hashes.reserve(GetDocumentCount());
+        for (const auto& [hash, ids] : hash_content_) {
+            for (const int id : ids) {
+                content_hashes.push_back({hash, id});
+            }
+        }
+        sort(content_hashes.begin(), content_hashes.end(), [](const ContentHash& lhs, const ContentHash& rhs) {
+            return pair{lhs.hash, lhs.id} < pair{rhs.hash, rhs.id};
+        });
+        writer.AddSection(IndexSection::CONTENT_HASHES, move(content_hashes));
+    }
+    writer.AddSection(IndexSection::LOG_DOCUMENT_FREQS, log_document_freqs_);
+    writer.AddSection(IndexSection::DOCUMENT_BAND_KEYS, document_band_keys_);
+    writer.Write(path);
+}
+
+SearchServer SearchServer::LoadIndex(const string& path, bool verify_checksums) {
+    const IndexFileReader reader(path, verify_checksums);
+    const auto metadata = reader.GetArray<IndexMetadata>(IndexSection::METADATA);
+    if (metadata.size() != 1 || metadata[0].hash_probe != ComputeHashProbe()) {
+        throw runtime_error("Index file "s + path + " was written by an incompatible build"s);
+    }
+
+    SearchServer result;
+    result.index_file_ = reader.GetFile();
+    result.terms_ = TermDictionary::Load(reader);
+    result.inverted_index_ = InvertedIndex::Load(reader);
+    result.document_term_ends_ = reader.GetArray<size_t>(IndexSection::DOCUMENT_TERM_ENDS);
+    result.document_terms_ = reader.GetArray<TermFreq>(IndexSection::DOCUMENT_TERMS);
+    result.documents_ = reader.GetArray<DocumentData>(IndexSection::DOCUMENTS);
+    result.id_ordinals_ = reader.GetArray<DocumentIdOrdinal>(IndexSection::DOCUMENT_ID_ORDINALS);
+    result.mapped_content_hashes_ = reader.GetArray<ContentHash>(IndexSection::CONTENT_HASHES);
+    result.log_document_freqs_ = reader.GetArray<double>(IndexSection::LOG_DOCUMENT_FREQS);
+    result.document_band_keys_ = reader.GetArray<BandKeys>(IndexSection::DOCUMENT_BAND_KEYS);
+
+    const auto& ends = result.document_term_ends_;
+    if (metadata[0].stop_word_count > result.terms_.Size() || ends.size() != result.documents_.size() ||
+        (ends.empty() ? 0 : ends.back()) != result.document_terms_.size() || result.mapped_content_hashes_.size() != result.id_ordinals_.size() ||
+        result.log_document_freqs_.size() > result.terms_.Size() || result.document_band_keys_.size() != result.documents_.size()) {
+        throw runtime_error("Index file "s + path + " is inconsistent"s);
+    }
+    // Stop words are the first terms of the dictionary
+    for (TermId term = 0; term < metadata[0].stop_word_count; ++term) {
+        result.stop_words_.emplace(result.terms_.GetTerm(term));
+    }
+    // Files hold no pending removals, so every id entry is of a present document
+    result.document_count_ = static_cast<int>(result.id_ordinals_.size());
+    result.log_document_count_ = log(static_cast<double>(result.GetDocumentCount()));
+    return result;
+}
+
+void SearchServer::SetQueryCacheCapacity(size_t capacity) {
+    query_cache_.SetCapacity(capacity);
+}
+
+QueryCache::Statistics SearchServer::GetQueryCacheStatistics() const {
+    return query_cache_.GetStatistics();
+}
+
+uint64_t SearchServer::GetGeneration() const {
+    return generation_;
+}
+
+bool SearchServer::IsStopTerm(TermId term) const {
+    return term < stop_words_.size();
+}
+
+void SearchServer::InternStopWords() {
+    if (any_of(stop_words_.begin(), stop_words_.end(), [](const string& word) {
+            return !IsValidWord(word);
+        })) {
+        throw invalid_argument("Invalid stop words"s);
+    }
+    for (const string& word : stop_words_) {
+        terms_.Intern(word);
+    }
+}
+
+void SearchServer::Detach() {
+    inverted_index_.Detach();
+    log_document_freqs_.Mutable();
+    // Pairs are sorted by hash and id, so ids of every hash come in ascending order
+    hash_content_.reserve(mapped_content_hashes_.size());
+    for (const auto [hash, id] : mapped_content_hashes_) {
+        hash_content_[hash].push_back(id);
+    }
+    mapped_content_hashes_ = {};
+}
+
+const SearchServer::DocumentIdOrdinal* SearchServer::FindDocument(int document_id) const {
+    const auto ptr = lower_bound(id_ordinals_.begin(), id_ordinals_.end(), document_id, [](const DocumentIdOrdinal& item, int id) {
+        return item.id < id;
+    });
+    return ptr != id_ordinals_.end() && ptr->id == document_id && !documents_[ptr->ordinal].is_removed ? ptr : nullptr;
+}
+
+void SearchServer::InsertDocumentId(int document_id, DocumentOrdinal ordinal) {
+    // Ids usually grow, so the entry goes to the end
+    auto& id_ordinals = id_ordinals_.Mutable();
+    auto pos = id_ordinals.end();
+    if (!id_ordinals.empty() && id_ordinals.back().id >= document_id) {
+        pos = lower_bound(id_ordinals.begin(), id_ordinals.end(), document_id, [](const DocumentIdOrdinal& item, int id) {
+            return item.id < id;
+        });
+    }
+    if (pos != id_ordinals.end() && pos->id == document_id) {
+        pos->ordinal = ordinal;
+    } else {
+        id_ordinals.insert(pos, {document_id, ordinal});
+    }
+    ++document_count_;
+}
+
+void SearchServer::AppendDocumentTerms(const vector<TermFreq>& document_terms) {
+    auto& terms = document_terms_.Mutable();
+    terms.insert(terms.end(), document_terms.begin(), document_terms.end());
+    document_term_ends_.Mutable().push_back(terms.size());
+}
+
+ArrayView<SearchServer::TermFreq> SearchServer::GetDocumentTerms(DocumentOrdinal ordinal) const {
+    const TermFreq* terms = document_terms_.data();
+    return {terms + (ordinal > 0 ? document_term_ends_[ordinal - 1] : 0), terms + document_term_ends_[ordinal]};
+}
+
+bool SearchServer::ContainsTerm(ArrayView<TermFreq> terms, TermId term) {
+    const auto ptr = lower_bound(terms.begin(), terms.end(), term, [](const TermFreq& item, TermId value) {
+        return item.term < value;
+    });
+    return ptr != terms.end() && ptr->term == term;
+}
+
+size_t SearchServer::ComputeContentHash(ArrayView<TermFreq> document_terms) const {
+    size_t result = 0;
+    for (const TermFreq& item : document_terms) {
+        result += MixWordHash(terms_.GetHash(item.term));
+    }
+    return result;
+}
+
+void SearchServer::ComputeFingerprints(ParsedDocument& document) const {
+    size_t content_hash = 0;
+    MinHashSignature signature;
+    const auto add_word = [&content_hash, &signature](size_t word_hash) {
+        const uint64_t mixed_hash = MixWordHash(word_hash);
+        content_hash += mixed_hash;
+        signature.Add(mixed_hash);
+    };
+
+    // Known words hash through the dictionary, new ones the way it will hash them when they are interned
+    sort(document.terms.begin(), document.terms.end());
+    for (size_t i = 0; i < document.terms.size(); ++i) {
+        if (i == 0 || document.terms[i] != document.terms[i - 1]) {
+            add_word(terms_.GetHash(document.terms[i]));
+        }
+    }
+    // Sorting by hash first compares words only for equal hashes
+    vector<pair<size_t, string_view>> new_words;
+    new_words.reserve(document.new_words.size());
+    for (const string_view word : document.new_words) {
+        new_words.emplace_back(hash<string_view>{}(word), word);
+    }
+    sort(new_words.begin(), new_words.end());
+    for (size_t i = 0; i < new_words.size(); ++i) {
+        if (i == 0 || new_words[i] != new_words[i - 1]) {
+            add_word(new_words[i].first);
         }
-        for (auto ptr = next(ids.begin()), last = ids.end(); ptr != last;) {
-            int id = *ptr;
-            ptr = ids.erase(ptr);
-            RemoveDocument(id);
-            cout << "Found duplicate document "s << id << endl;
+    }
+    document.content_hash = content_hash;
+    document.band_keys = signature.GetBandKeys();
+}
+
+optional<int> SearchServer::FindContentHash(size_t hash, int except_id) const {
+    // A loaded server looks hashes up in the mapped pairs until its first mutation
+    if (!mapped_content_hashes_.empty()) {
+        const auto [first, last] = equal_range(mapped_content_hashes_.begin(), mapped_content_hashes_.end(), ContentHash{hash, 0},
+                                               [](const ContentHash& lhs, const ContentHash& rhs) {
+                                                   return lhs.hash < rhs.hash;
+                                               });
+        for (auto ptr = first; ptr != last; ++ptr) {
+            if (ptr->id != except_id) {
+                return ptr->id;
+            }
+        }
+        return nullopt;
+    }
+    const auto ids = hash_content_.find(hash);
+    if (ids != hash_content_.end()) {
+        for (const int id : ids->second) {
+            if (id != except_id) {
+                return id;
+            }
         }
     }
+    return nullopt;
 }
 
-bool SearchServer::IsStopWord(const string_view word) const {
-    return stop_words_.count(word) > 0;
+void SearchServer::AddContentHash(size_t hash, int document_id) {
+    auto& ids = hash_content_[hash];
+    ids.insert(upper_bound(ids.begin(), ids.end(), document_id), document_id);
+}
+
+void SearchServer::RemoveContentHash(size_t hash, int document_id) {
+    const auto ids = hash_content_.find(hash);
+    ASSERT(ids != hash_content_.end());
+    auto& hash_ids = ids->second;
+    hash_ids.erase(find(hash_ids.begin(), hash_ids.end(), document_id));
+    if (hash_ids.empty()) {
+        hash_content_.erase(ids);
+    }
+}
+
+exception_ptr SearchServer::CheckDuplicate(size_t hash) const {
+    if (duplicate_policy_ == DuplicatePolicy::REJECT) {
+        if (const auto original_id = FindContentHash(hash, -1)) {
+            return make_exception_ptr(invalid_argument("Document duplicates document "s + to_string(*original_id)));
+        }
+    }
+    return nullptr;
+}
+
+void SearchServer::ReportDuplicates(const vector<int>& document_ids) {
+    // One write instead of a flush per line
+    string report;
+    for (const int id : document_ids) {
+        report += "Found duplicate document "s + to_string(id) + '\n';
+    }
+    cout << report << flush;
+}
+
+vector<SearchServer::OrdinalPair> SearchServer::FindBandCandidates(size_t band) const {
+    vector<pair<uint32_t, DocumentOrdinal>> keys;
+    keys.reserve(GetDocumentCount());
+    for (size_t ordinal = 0; ordinal < documents_.size(); ++ordinal) {
+        if (!documents_[ordinal].is_removed) {
+            keys.emplace_back(document_band_keys_[ordinal][band], static_cast<DocumentOrdinal>(ordinal));
+        }
+    }
+    sort(keys.begin(), keys.end());
+
+    // Small runs are compared pairwise, so a chain of similar documents is linked whatever their order. A larger run
+    // pairs every document with the first and the previous one, which keeps a band linear when many documents share
+    // a key.
+    vector<OrdinalPair> result;
+    for (size_t start = 0, end = 0; start < keys.size(); start = end) {
+        while (end < keys.size() && keys[end].first == keys[start].first) {
+            ++end;
+        }
+        for (size_t i = start + 1; i < end; ++i) {
+            const size_t first = end - start <= MAX_PAIRWISE_BAND_RUN ? start : i - 1;
+            for (size_t j = first; j < i; ++j) {
+                result.emplace_back(keys[j].second, keys[i].second);
+            }
+            if (first != start) {
+                result.emplace_back(keys[start].second, keys[i].second);
+            }
+        }
+    }
+    return result;
+}
+
+bool SearchServer::IsNearDuplicate(DocumentOrdinal lhs, DocumentOrdinal rhs, double min_similarity) const {
+    const auto lhs_terms = GetDocumentTerms(lhs);
+    const auto rhs_terms = GetDocumentTerms(rhs);
+    const size_t smaller = min(lhs_terms.size(), rhs_terms.size());
+    const size_t larger = max(lhs_terms.size(), rhs_terms.size());
+    // Documents without words have equal sets; otherwise similarity is at most smaller / larger
+    if (larger == 0) {
+        return true;
+    }
+    if (static_cast<double>(smaller) < min_similarity * static_cast<double>(larger)) {
+        return false;
+    }
+    size_t common = 0;
+    auto lhs_ptr = lhs_terms.begin();
+    auto rhs_ptr = rhs_terms.begin();
+    while (lhs_ptr != lhs_terms.end() && rhs_ptr != rhs_terms.end()) {
+        if (lhs_ptr->term < rhs_ptr->term) {
+            ++lhs_ptr;
+        } else if (rhs_ptr->term < lhs_ptr->term) {
+            ++rhs_ptr;
+        } else {
+            ++common;
+            ++lhs_ptr;
+            ++rhs_ptr;
+        }
+    }
+    return static_cast<double>(common) >= min_similarity * static_cast<double>(lhs_terms.size() + rhs_terms.size() - common);
 }
 
-vector<string_view> SearchServer::SplitIntoWordsNoStop(const string_view text) const {
-    vector<string_view> words;
-    for (const string_view word : SplitIntoWords(text)) {
-        if (!IsValidWord(word)) {
-            throw invalid_argument("Word "s + static_cast<string>(word) + " is invalid"s);
+vector<vector<int>> SearchServer::MakeNearDuplicateClusters(const vector<OrdinalPair>& similar_pairs) const {
+    // Union-find over ordinals; the root of a set is its smallest ordinal
+    vector<DocumentOrdinal> parents(documents_.size());
+    iota(parents.begin(), parents.end(), 0);
+    const auto find_root = [&parents](DocumentOrdinal ordinal) {
+        while (parents[ordinal] != ordinal) {
+            parents[ordinal] = parents[parents[ordinal]];
+            ordinal = parents[ordinal];
         }
-        if (!IsStopWord(word)) {
-            words.push_back(word);
+        return ordinal;
+    };
+    vector<DocumentOrdinal> members;
+    for (const auto& [lhs, rhs] : similar_pairs) {
+        const DocumentOrdinal lhs_root = find_root(lhs);
+        const DocumentOrdinal rhs_root = find_root(rhs);
+        parents[max(lhs_root, rhs_root)] = min(lhs_root, rhs_root);
+        members.push_back(lhs);
+        members.push_back(rhs);
+    }
+    sort(members.begin(), members.end());
+    members.erase(unique(members.begin(), members.end()), members.end());
+
+    vector<pair<DocumentOrdinal, int>> root_ids;
+    root_ids.reserve(members.size());
+    for (const DocumentOrdinal ordinal : members) {
+        root_ids.emplace_back(find_root(ordinal), documents_[ordinal].id);
+    }
+    sort(root_ids.begin(), root_ids.end());
+    vector<vector<int>> result;
+    for (size_t i = 0; i < root_ids.size(); ++i) {
+        if (i == 0 || root_ids[i].first != root_ids[i - 1].first) {
+            result.emplace_back();
         }
+        result.back().push_back(root_ids[i].second);
     }
-    return words;
+    sort(result.begin(), result.end());
+    return result;
 }
 
 int SearchServer::ComputeAverageRating(const vector<int>& ratings) {
@@ -131,7 +629,40 @@ int SearchServer::ComputeAverageRating(const vector<int>& ratings) {
     return rating_sum / static_cast<int>(ratings.size());
 }
 
-SearchServer::QueryWord SearchServer::ParseQueryWord(string_view word) const {
+SearchServer::ParsedDocument SearchServer::ParseDocument(const string_view text) const noexcept {
+    ParsedDocument result;
+    try {
+        ForEachCheckedWord(text, [this, &result](const string_view word, bool is_valid) {
+            if (!is_valid) {
+                throw invalid_argument("Word "s + static_cast<string>(word) + " is invalid"s);
+            }
+            const TermId term = terms_.Find(word);
+            if (term == NO_TERM) {
+                result.new_words.push_back(word);
+            } else if (!IsStopTerm(term)) {
+                result.terms.push_back(term);
+            }
+        });
+    } catch (...) {
+        result.error = current_exception();
+    }
+    return result;
+}
+
+vector<SearchServer::TermFreq> SearchServer::MakeDocumentTerms(vector<TermId> word_terms) {
+    sort(word_terms.begin(), word_terms.end());
+
+    const double inv_word_count = 1.0 / word_terms.size();
+    vector<TermFreq> document_terms;
+    for (auto ptr = word_terms.begin(); ptr != word_terms.end();) {
+        const auto run_end = upper_bound(ptr, word_terms.end(), *ptr);
+        document_terms.push_back({*ptr, (run_end - ptr) * inv_word_count});
+        ptr = run_end;
+    }
+    return document_terms;
+}
+
+SearchServer::QueryWord SearchServer::ParseQueryWord(string_view word, bool is_valid) const {
     if (word.empty()) {
         throw invalid_argument("Query word is empty"s);
     }
@@ -140,25 +671,26 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(string_view word) const {
         is_minus = true;
         word = word.substr(1);
     }
-    if (word.empty() || word[0] == '-' || !IsValidWord(word)) {
+    if (word.empty() || word[0] == '-' || !is_valid) {
         throw invalid_argument("Query word "s + static_cast<string>(word) + " is invalid");
     }
 
-    return {word, is_minus, IsStopWord(word)};
+    const TermId term = terms_.Find(word);
+    return {word, term, is_minus, IsStopTerm(term)};
 }
 
 SearchServer::Query SearchServer::ParseQuery(const string_view text, bool make_unique) const {
+    StageTimer timer(Stage::QUERY_PARSE);
     Query result;
-    const auto words = SplitIntoWords(text);
-    std::for_each(words.begin(), words.end(), [this, &result](const string_view word) {
-        const auto query_word = ParseQueryWord(word);
-        if (query_word.is_stop) {
+    ForEachCheckedWord(text, [this, &result](const string_view word, bool is_valid) {
+        const auto query_word = ParseQueryWord(word, is_valid);
+        if (query_word.is_stop || query_word.term == NO_TERM) {
             return;
         }
         if (query_word.is_minus) {
-            result.minus_words.push_back(query_word.data);
+            result.minus_words.push_back(query_word.term);
         } else {
-            result.plus_words.push_back(query_word.data);
+            result.plus_words.push_back(query_word.term);
         }
     });
     if (make_unique) {
@@ -167,11 +699,119 @@ SearchServer::Query SearchServer::ParseQuery(const string_view text, bool make_u
     return result;
 }
 
-double SearchServer::ComputeWordInverseDocumentFreq(const string_view word) const {
-    auto ptr = word_to_document_freqs_.find(word);
-    assert(ptr != word_to_document_freqs_.end());
+const SearchServer::Query& SearchServer::ResolveQuery(const PreparedQuery& prepared_query, Query& buffer) const {
+    // The dictionary only grows, so resolved terms stay valid and only unknown words may have appeared
+    if (prepared_query.term_count_ == terms_.Size() ||
+        (prepared_query.unknown_plus_words_.empty() && prepared_query.unknown_minus_words_.empty())) {
+        return prepared_query.query_;
+    }
+    buffer = prepared_query.query_;
+    for (const string& word : prepared_query.unknown_plus_words_) {
+        if (const TermId term = terms_.Find(word); term != NO_TERM) {
+            buffer.plus_words.push_back(term);
+        }
+    }
+    for (const string& word : prepared_query.unknown_minus_words_) {
+        if (const TermId term = terms_.Find(word); term != NO_TERM) {
+            buffer.minus_words.push_back(term);
+        }
+    }
+    buffer.MakeUnique();
+    return buffer;
+}
 
-    return log(GetDocumentCount() * 1.0 / ptr->second.size());
+string SearchServer::MakeQueryCacheKey(const Query& query, DocumentStatus status, size_t max_count) {
+    // Fixed-width fields: counts, terms of both lists, the status and the result size
+    string key;
+    key.reserve(sizeof(uint32_t) * 3 + sizeof(TermId) * (query.plus_words.size() + query.minus_words.size()) + sizeof(max_count));
+    const auto append = [&key](const auto value) {
+        key.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    append(static_cast<uint32_t>(query.plus_words.size()));
+    for (const TermId term : query.plus_words) {
+        append(term);
+    }
+    append(static_cast<uint32_t>(query.minus_words.size()));
+    for (const TermId term : query.minus_words) {
+        append(term);
+    }
+    append(static_cast<uint32_t>(status));
+    append(max_count);
+    return key;
+}
+
+void SearchServer::UpdateTermStatistics(TermId term) {
+    const size_t document_freq = inverted_index_.DocumentFreq(term);
+    log_document_freqs_.Mutable()[term] = document_freq > 0 ? log(static_cast<double>(document_freq)) : 0.0;
+}
+
+double SearchServer::ComputeWordInverseDocumentFreq(TermId term) const {
+    assert(inverted_index_.DocumentFreq(term) > 0);
+
+    return log_document_count_ - log_document_freqs_[term];
+}
+
+double SearchServer::ComputeRelevance(const vector<pair<TermId, double>>& plus_terms, DocumentOrdinal ordinal) const {
+    // Both sequences are sorted by term id, so walking document terms keeps the order of plus terms
+    const auto document_terms = GetDocumentTerms(ordinal);
+    auto plus_ptr = plus_terms.begin();
+    double relevance = 0.0;
+    for (const auto [term, term_freq] : document_terms) {
+        plus_ptr = lower_bound(plus_ptr, plus_terms.end(), term, [](const pair<TermId, double>& item, TermId value) {
+            return item.first < value;
+        });
+        if (plus_ptr == plus_terms.end()) {
+            break;
+        }
+        if (plus_ptr->first == term) {
+            relevance += term_freq * plus_ptr->second;
+        }
+    }
+    return relevance;
+}
+
+vector<DocumentMatch> SearchServer::MatchOrdinalRange(const vector<pair<string_view, TermId>>& plus_words, const vector<TermId>& minus_words,
+                                                   const DocumentOrdinal* first, const DocumentOrdinal* last) const {
+    vector<DocumentMatch> result(last - first);
+    for (size_t i = 0; i < result.size(); ++i) {
+        const DocumentData& document = documents_[first[i]];
+        result[i].id = document.id;
+        result[i].status = document.status;
+    }
+
+    // Calls found(i) for every ordinal first[i] with a posting of term. The cursor and the position in the ordinals
+    // skip ahead of each other, so sparse ordinals and sparse postings both cost little.
+    const auto for_each_posting = [this, first, last](TermId term, const auto found) {
+        PostingCursor cursor(inverted_index_, term);
+        const DocumentOrdinal* target = first;
+        cursor.Seek(*target);
+        while (!cursor.IsEnd() && target != last) {
+            if (cursor.Ordinal() < *target) {
+                cursor.Seek(*target);
+            } else if (cursor.Ordinal() > *target) {
+                target = lower_bound(target, last, cursor.Ordinal());
+            } else {
+                found(target - first);
+                ++target;
+                cursor.Next();
+            }
+        }
+    };
+
+    vector<bool> is_excluded(result.size());
+    for (const TermId term : minus_words) {
+        for_each_posting(term, [&is_excluded](size_t i) {
+            is_excluded[i] = true;
+        });
+    }
+    for (const auto& [word, term] : plus_words) {
+        for_each_posting(term, [&result, &is_excluded, word = word](size_t i) {
+            if (!is_excluded[i]) {
+                result[i].words.push_back(word);
+            }
+        });
+    }
+    return result;
 }
 
 bool SearchServer::IsValidWord(const string_view word) {
@@ -206,12 +846,9 @@ void FindTopDocuments(const SearchServer& search_server, const string& raw_query
 void MatchDocuments(const SearchServer& search_server, const string& query) {
     try {
         cout << "Матчинг документов по запросу: "s << query << endl;
-        const int document_count = search_server.GetDocumentCount();
-        for (int index = 0; index < document_count; ++index) {
-            const int document_id = *(search_server.begin() + index);
-            const auto [words, status] = search_server.MatchDocument(query, document_id);
-            PrintMatchDocumentResult(document_id, words, status);
-        }
+        search_server.MatchDocuments(execution::par, search_server.PrepareQuery(query), [](const DocumentMatch& match) {
+            PrintMatchDocumentResult(match.id, match.words, match.status);
+        });
     } catch (const exception& e) {
         cout << "Ошибка матчинга документов на запрос "s << query << ": "s << e.what() << endl;
     }
@@ -2,29 +2,56 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <cstddef>
+#include <exception>
 #include <execution>
 #include <functional>
 #include <future>
 #include <iterator>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <numeric>
+#include <optional>
 #include <ostream>
+#include <queue>
 #include <set>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
-#include "concurrent_map.h"
 #include "document.h"
+#include "index_file.h"
+#include "inverted_index.h"
+#include "mapped_array.h"
+#include "metrics.h"
+#include "min_hash.h"
 #include "paginator.h"
+#include "query_cache.h"
+#include "query_executor.h"
 #include "string_processing.h"
+#include "term_dictionary.h"
 #include "test_framework.h"
 
-const int MAX_RESULT_DOCUMENT_COUNT = 5;
+using namespace std::string_literals;
+
+const size_t MAX_RESULT_DOCUMENT_COUNT = 5;
 constexpr const double THRESHOLD = 1e-6;
+/// Smallest ordinal range scored by one task of a parallel query
+constexpr const size_t MIN_ORDINAL_RANGE_SIZE = 1024;
+/// Documents matched by one task of SearchServer::MatchDocuments
+constexpr const size_t MATCH_RANGE_SIZE = 4096;
+/// Documents sharing a band key are compared pairwise when there are at most this many; every document of a larger
+/// run is compared with the first and the previous document of the run only
+constexpr const size_t MAX_PAIRWISE_BAND_RUN = 32;
 
 template <class ExecutionPolicy>
 using IsExecutionPolicy = std::is_execution_policy<std::decay_t<ExecutionPolicy>>;
@@ -32,10 +59,27 @@ using IsExecutionPolicy = std::is_execution_policy<std::decay_t<ExecutionPolicy>
 template <class ExecutionPolicy>
 using EnableForExecutionPolicy = typename std::enable_if_t<IsExecutionPolicy<ExecutionPolicy>::value, bool>;
 
+template <class ExecutionPolicy>
+using IsExecutorPolicy = std::is_same<std::decay_t<ExecutionPolicy>, ExecutorPolicy>;
+
+/// Searches take standard policies and ExecutorPolicy
+template <class ExecutionPolicy>
+using EnableForSearchPolicy =
+    typename std::enable_if_t<IsExecutionPolicy<ExecutionPolicy>::value || IsExecutorPolicy<ExecutionPolicy>::value, bool>;
+
+/// How the server treats a new document with the same set of words as a present one
+enum class DuplicatePolicy {
+    /// Add it; RemoveDuplicates or FindDuplicate find it later
+    KEEP,
+    /// Throw std::invalid_argument instead of adding it
+    REJECT,
+};
+
 class SearchServer {
    public:
-    using IdsConstIterator = std::vector<int>::const_iterator;
-    using IdsIterator = std::vector<int>::iterator;
+    class IdsConstIterator;
+
+    class PreparedQuery;
 
     SearchServer() = default;
 
@@ -46,27 +90,67 @@ class SearchServer {
 
     explicit SearchServer(const std::string& stop_words_text);
 
-    /// Add new document to the search server's internal database
+    /// Add new document to the search server's internal database. A duplicate of a present document is treated
+    /// according to the duplicate policy.
     void AddDocument(int document_id, const std::string_view document, DocumentStatus status = DocumentStatus::ACTUAL,
                      const std::vector<int>& ratings = {});
 
-    /// Find most matched documents for request
-    template <typename ExecutionPolicy, typename DocumentPredicate, EnableForExecutionPolicy<ExecutionPolicy> = true>
-    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query, DocumentPredicate predicate) const;
+    /// Add a batch of documents. Documents are tokenized, validated and fingerprinted concurrently and merged into the
+    /// index in one pass. Like a loop of AddDocument calls, documents before the first invalid one are added and its
+    /// error is thrown; with DuplicatePolicy::REJECT a duplicate of an earlier document of the batch is invalid too.
+    template <typename ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy> = true>
+    void AddDocuments(ExecutionPolicy&& policy, const std::vector<NewDocument>& documents);
+
+    void AddDocuments(const std::vector<NewDocument>& documents);
+
+    /// Find at most max_count most matched documents for request. With ExecutorPolicy the ordinal ranges of the query
+    /// run as tasks of the executor, so a query issued by one of its workers adds no threads.
+    template <typename ExecutionPolicy, typename DocumentPredicate, EnableForSearchPolicy<ExecutionPolicy> = true>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query, DocumentPredicate predicate,
+                                           size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
 
-    /// Find most matched documents for request
+    /// Find at most max_count most matched documents for request
     template <typename DocumentPredicate>
-    std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentPredicate predicate) const;
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentPredicate predicate,
+                                           size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
 
-    template <class ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy> = true>
+    /// Same with IDF of every plus word taken from inverse_document_freq(word) instead of the documents of this server,
+    /// for a server holding one part of a collection. It is called only for words of present documents.
+    template <typename ExecutionPolicy, typename DocumentPredicate, typename InverseDocumentFreq, EnableForSearchPolicy<ExecutionPolicy> = true>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query, DocumentPredicate predicate,
+                                           size_t max_count, InverseDocumentFreq inverse_document_freq) const;
+
+    template <class ExecutionPolicy, EnableForSearchPolicy<ExecutionPolicy> = true>
     std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query) const;
 
     std::vector<Document> FindTopDocuments(const std::string_view raw_query) const;
 
-    template <class ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy> = true>
-    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query, DocumentStatus status) const;
+    template <class ExecutionPolicy, EnableForSearchPolicy<ExecutionPolicy> = true>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query, DocumentStatus status,
+                                           size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentStatus status,
+                                           size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    /// Parses and validates raw_query once for any number of searches and matches, which may run concurrently.
+    /// Throws std::invalid_argument like FindTopDocuments for an invalid query.
+    PreparedQuery PrepareQuery(const std::string_view raw_query) const;
+
+    template <typename ExecutionPolicy, typename DocumentPredicate, EnableForSearchPolicy<ExecutionPolicy> = true>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query, DocumentPredicate predicate,
+                                           size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const PreparedQuery& query, DocumentPredicate predicate,
+                                           size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
 
-    std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentStatus status) const;
+    template <class ExecutionPolicy, EnableForSearchPolicy<ExecutionPolicy> = true>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query,
+                                           DocumentStatus status = DocumentStatus::ACTUAL,
+                                           size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    std::vector<Document> FindTopDocuments(const PreparedQuery& query, DocumentStatus status = DocumentStatus::ACTUAL,
+                                           size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
 
     /// Get total number of documents in internal database
     int GetDocumentCount() const;
@@ -77,44 +161,219 @@ class SearchServer {
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(ExecutionPolicy&& policy, const std::string_view raw_query,
                                                                             int document_id) const;
 
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const PreparedQuery& query, int document_id) const;
+
+    template <typename ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy> = true>
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(ExecutionPolicy&& policy, const PreparedQuery& query,
+                                                                            int document_id) const;
+
+    /// Matches query against every present document, giving consumer the DocumentMatch of each in insertion order,
+    /// with the words and status MatchDocument returns for it. The query is resolved once and the posting list of
+    /// every word is walked once instead of probing documents one by one. Ranges of documents are matched concurrently
+    /// a batch at a time and consumer is called from the calling thread after each batch, so results stream out while
+    /// memory stays bounded by the batch.
+    template <typename ExecutionPolicy, typename Consumer, EnableForExecutionPolicy<ExecutionPolicy> = true>
+    void MatchDocuments(ExecutionPolicy&& policy, const PreparedQuery& query, Consumer consumer) const;
+
+    template <typename Consumer>
+    void MatchDocuments(const PreparedQuery& query, Consumer consumer) const;
+
+    /// Same for the documents with the given ids, still in insertion order; a repeated id is matched once.
+    /// Throws std::out_of_range before matching if a document is absent.
+    template <typename ExecutionPolicy, typename Consumer, EnableForExecutionPolicy<ExecutionPolicy> = true>
+    void MatchDocuments(ExecutionPolicy&& policy, const PreparedQuery& query, const std::vector<int>& document_ids, Consumer consumer) const;
+
+    template <typename Consumer>
+    void MatchDocuments(const PreparedQuery& query, const std::vector<int>& document_ids, Consumer consumer) const;
+
     std::set<std::string, std::less<>> GetStopWords() const;
 
     IdsConstIterator begin() const;
 
     IdsConstIterator end() const;
 
+    /// Term frequencies of the words of document, empty for an absent one. The map is built on the first request
+    /// and stays valid until the document is removed.
     const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
 
+    /// Calls visitor(word) for every distinct word of document, nothing for an absent one
+    template <typename Visitor>
+    void ForEachDocumentWord(int document_id, Visitor visitor) const;
+
+    /// Removes document in time proportional to the number of its words, whatever the size of the index: the
+    /// document is marked removed and leaves document frequencies at once, while its postings stay in place and
+    /// queries skip them until PurgeRemovedDocuments.
     void RemoveDocument(int document_id);
 
     template <typename ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy> = true>
     void RemoveDocument(ExecutionPolicy&& policy, int document_id);
 
+    /// Removes documents with the given ids, skipping absent ones. Term statistics of all of them are updated at once.
+    template <typename ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy> = true>
+    void RemoveDocuments(ExecutionPolicy&& policy, const std::vector<int>& document_ids);
+
+    void RemoveDocuments(const std::vector<int>& document_ids);
+
+    /// Removes every document with the same set of words as a document with a smaller id and reports the removed ids
+    /// in ascending order. Duplicates are found by content fingerprints in one pass and removed as one batch.
+    template <typename ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy> = true>
+    void RemoveDuplicates(ExecutionPolicy&& policy);
+
     void RemoveDuplicates();
 
+    /// Smallest id of another present document with the same set of words as document_id
+    std::optional<int> FindDuplicate(int document_id) const;
+
+    /// Applies to documents added from now on. The policy is not saved in index files.
+    void SetDuplicatePolicy(DuplicatePolicy policy);
+
+    /// Clusters of present documents with similar sets of words: every document of a cluster is linked to another one
+    /// by a chain of pairs with Jaccard similarity of at least min_similarity. Candidate pairs come from the LSH bands of
+    /// MinHash signatures kept for every document, so the work grows with the number of documents rather than pairs;
+    /// a pair is missed with the odds given for MIN_HASH_BAND_ROWS, small for similarity above 0.7. Documents sharing
+    /// a band key are all compared with each other unless there are more than MAX_PAIRWISE_BAND_RUN of them; such a
+    /// crowded key only links neighbours, so a chain through it may be missed too. Ids of a cluster are ascending,
+    /// clusters are ordered by their first id.
+    /// Throws std::invalid_argument unless min_similarity is in (0, 1].
+    template <typename ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy> = true>
+    std::vector<std::vector<int>> FindNearDuplicates(ExecutionPolicy&& policy, double min_similarity) const;
+
+    std::vector<std::vector<int>> FindNearDuplicates(double min_similarity) const;
+
+    /// Collapses every cluster found by FindNearDuplicates to the document with the smallest id, removing the others
+    /// as one batch, and reports the removed ids in ascending order
+    template <typename ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy> = true>
+    void RemoveNearDuplicates(ExecutionPolicy&& policy, double min_similarity);
+
+    void RemoveNearDuplicates(double min_similarity);
+
+    /// Drops documents removed since the last purge and numbers the present ones densely again: postings, id entries,
+    /// the forward index, band keys and document lengths are renumbered through one old-to-new ordinal table, so
+    /// memory and scans follow the present documents only. Takes one pass over every posting list. Results of queries
+    /// stay the same, so cached ones stay valid.
+    void PurgeRemovedDocuments();
+
+    /// Number of documents removed since the last purge
+    size_t GetPendingRemovalCount() const;
+
+    /// Switch posting lists to the compressed representation.
+    /// Documents added afterwards stay uncompressed until the next call.
+    void CompressIndex();
+
+    /// Heap memory taken by posting lists, in bytes; pages of a mapped index file are not counted
+    size_t GetIndexMemoryUsage() const;
+
+    /// Writes the whole server to a binary index file; pending removals are purged in a copy written instead
+    void SaveIndex(const std::string& path) const;
+
+    /// Server serving queries right from the pages of a mapped index file written by SaveIndex, so nothing is
+    /// deserialized. The first mutation takes private copies of the mapped arrays it changes.
+    /// Throws std::runtime_error if the file is not a valid index file.
+    static SearchServer LoadIndex(const std::string& path, bool verify_checksums = true);
+
+    /// Caches results of FindTopDocuments by status for capacity most recently used queries; zero disables the cache.
+    /// Queries with a custom predicate are never cached.
+    void SetQueryCacheCapacity(size_t capacity);
+
+    QueryCache::Statistics GetQueryCacheStatistics() const;
+
+    /// Number of mutations of the documents so far; results of equal queries at one generation are equal
+    uint64_t GetGeneration() const;
+
    private:
     struct DocumentData {
+        int id = 0;
         int rating = 0;
         DocumentStatus status = DocumentStatus::ACTUAL;
+        /// Set by RemoveDocument; the slot is dropped by the next purge
+        bool is_removed = false;
+    };
+    using TermFreq = DocumentTerm;
+    using OrdinalPair = std::pair<DocumentOrdinal, DocumentOrdinal>;
+    struct DocumentIdOrdinal {
+        int id = 0;
+        DocumentOrdinal ordinal = 0;
+    };
+    struct ContentHash {
+        size_t hash = 0;
+        int id = 0;
+    };
+    /// Scalars of an index file
+    struct IndexMetadata {
+        uint64_t stop_word_count = 0;
+        /// Hash of a fixed word: hashes stored in the file are valid only for a build hashing it the same way
+        uint64_t hash_probe = 0;
+    };
+    /// Document tokenized by AddDocuments, or the error AddDocument would throw for it
+    struct ParsedDocument {
+        /// Words already known to the dictionary
+        std::vector<TermId> terms;
+        /// Words to intern, in the order of the text
+        std::vector<std::string_view> new_words;
+        std::exception_ptr error;
+        /// Set by ComputeFingerprints
+        size_t content_hash = 0;
+        BandKeys band_keys{};
     };
     struct QueryWord {
         std::string_view data;
+        TermId term = NO_TERM;
         bool is_minus = false;
         bool is_stop = false;
     };
 
+    /// Word frequencies handed out by GetWordFrequencies, safe to fill from concurrent calls. Views point into the
+    /// dictionary of the server, so a copy starts empty.
+    class WordFrequenciesCache {
+       public:
+        WordFrequenciesCache() = default;
+        WordFrequenciesCache(const WordFrequenciesCache&) {
+        }
+        WordFrequenciesCache& operator=(const WordFrequenciesCache&) {
+            Clear();
+            return *this;
+        }
+
+        /// Frequencies of document_id, computed by build() if they are not cached
+        template <typename Build>
+        const std::map<std::string_view, double>& Get(int document_id, Build build) {
+            std::lock_guard guard(mutex_);
+            auto [position, is_inserted] = frequencies_.try_emplace(document_id);
+            if (is_inserted) {
+                position->second = build();
+            }
+            return position->second;
+        }
+
+        void Erase(int document_id) {
+            std::lock_guard guard(mutex_);
+            frequencies_.erase(document_id);
+        }
+
+        void Clear() {
+            std::lock_guard guard(mutex_);
+            frequencies_.clear();
+        }
+
+       private:
+        std::mutex mutex_;
+        std::unordered_map<int, std::map<std::string_view, double>> frequencies_;
+    };
+
+    /// Query terms resolved through the term dictionary; words never seen by the server are dropped
+    /// since they cannot match any document
     struct Query {
-        std::vector<std::string_view> plus_words;
-        std::vector<std::string_view> minus_words;
+        std::vector<TermId> plus_words;
+        std::vector<TermId> minus_words;
 
         template <typename ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy> = true>
-        static void MakeUnique(ExecutionPolicy&& policy, std::vector<std::string_view>& words) {
+        static void MakeUnique(ExecutionPolicy&& policy, std::vector<TermId>& words) {
             std::sort(policy, words.begin(), words.end());
             auto last = std::unique(policy, words.begin(), words.end());
             words.erase(last, words.end());
         }
 
-        static void MakeUnique(std::vector<std::string_view>& words) {
+        static void MakeUnique(std::vector<TermId>& words) {
             Query::MakeUnique(std::execution::seq, words);
         }
 
@@ -129,42 +388,287 @@ class SearchServer {
         }
     };
 
+    /// Index file the mapped arrays borrow from, if the server was loaded
+    std::shared_ptr<const MappedFile> index_file_;
     std::set<std::string, std::less<>> stop_words_;
-    std::map<std::string, std::map<int, double>, std::less<>> word_to_document_freqs_;
-    std::map<int, std::map<std::string_view, double>> document_to_words_freqs_;
-    std::map<int, DocumentData> documents_;
-    std::vector<int> document_ids_;
-    std::map<size_t, std::set<int>> hash_content_;
+    /// Stop words are interned first, so their ids are [0, stop_words_.size())
+    TermDictionary terms_;
+    InvertedIndex inverted_index_;
+    /// Terms of every document sorted by term id, stored back to back in ordinal order; terms of ordinal i end at
+    /// document_term_ends_[i]. Terms of removed documents stay in place until the next purge.
+    MappedArray<TermFreq> document_terms_;
+    MappedArray<size_t> document_term_ends_;
+    /// Document attributes indexed by ordinal, removed documents included until the next purge; ids in ordinal order
+    /// are the ids in insertion order
+    MappedArray<DocumentData> documents_;
+    /// Ordinals sorted by id. Entries of removed documents stay until the next purge unless the id is added again.
+    MappedArray<DocumentIdOrdinal> id_ordinals_;
+    int document_count_ = 0;
+    size_t pending_removal_count_ = 0;
+    /// Ascending ids of present documents by content hash
+    std::unordered_map<size_t, std::vector<int>> hash_content_;
+    /// Content hashes of a loaded server sorted by hash and id; the first mutation moves them to hash_content_
+    MappedArray<ContentHash> mapped_content_hashes_;
+    DuplicatePolicy duplicate_policy_ = DuplicatePolicy::KEEP;
+    /// Band keys of the MinHash signature of the set of words of every document by ordinal, like documents_
+    MappedArray<BandKeys> document_band_keys_;
+    /// Cached IDF parts: log of the document count and logs of document frequencies indexed by term id.
+    /// Refreshed for the touched terms by every mutation, so queries never call log.
+    double log_document_count_ = 0.0;
+    MappedArray<double> log_document_freqs_;
+    uint64_t generation_ = 0;
+    /// Results of queries by status, valid while generation_ stays the same
+    mutable QueryCache query_cache_;
+    mutable WordFrequenciesCache word_frequencies_;
+
+    bool IsStopTerm(TermId term) const;
+
+    /// Validates stop_words_ and interns them as the first terms
+    void InternStopWords();
+
+    /// Takes private copies of mapped data changed by mutations that may run concurrently, and of content hashes
+    void Detach();
+
+    /// Entry of a present document, nullptr if there is none
+    const DocumentIdOrdinal* FindDocument(int document_id) const;
+
+    /// Registers id of a new document, taking over the entry of a removed document with the same id
+    void InsertDocumentId(int document_id, DocumentOrdinal ordinal);
+
+    /// Appends terms of the next ordinal to the forward index
+    void AppendDocumentTerms(const std::vector<TermFreq>& document_terms);
+
+    ArrayView<TermFreq> GetDocumentTerms(DocumentOrdinal ordinal) const;
+
+    static bool ContainsTerm(ArrayView<TermFreq> terms, TermId term);
+
+    /// Order-independent fingerprint of the set of words of a document: the sum of mixed hashes of its unique words,
+    /// so it is built from hashes kept by the dictionary without joining words. Equal fingerprints are taken for equal
+    /// sets; with 64 bits ten million documents share one by mistake with odds of about one in a million.
+    size_t ComputeContentHash(ArrayView<TermFreq> document_terms) const;
+
+    /// Content hash and band keys of a parsed document, which may have words the dictionary does not know yet;
+    /// sorts its terms
+    void ComputeFingerprints(ParsedDocument& document) const;
+
+    /// Smallest id of a present document with content hash other than except_id
+    std::optional<int> FindContentHash(size_t hash, int except_id) const;
+
+    void AddContentHash(size_t hash, int document_id);
+
+    void RemoveContentHash(size_t hash, int document_id);
+
+    /// Error AddDocument throws for a new document with content hash under the duplicate policy, if any
+    std::exception_ptr CheckDuplicate(size_t hash) const;
+
+    static void ReportDuplicates(const std::vector<int>& document_ids);
+
+    /// Pairs of present documents sharing the key of band, each paired with the smallest ordinal sharing it
+    std::vector<OrdinalPair> FindBandCandidates(size_t band) const;
+
+    /// Whether Jaccard similarity of the sets of words of two documents is at least min_similarity
+    bool IsNearDuplicate(DocumentOrdinal lhs, DocumentOrdinal rhs, double min_similarity) const;
+
+    /// Connected components of the pairs of documents, as ascending ids ordered by the first one
+    std::vector<std::vector<int>> MakeNearDuplicateClusters(const std::vector<OrdinalPair>& similar_pairs) const;
 
-    bool IsStopWord(const std::string_view word) const;
+    static int ComputeAverageRating(const std::vector<int>& ratings);
 
-    std::vector<std::string_view> SplitIntoWordsNoStop(const std::string_view text) const;
+    /// Splits document into words resolved through the dictionary without modifying it
+    ParsedDocument ParseDocument(const std::string_view text) const noexcept;
 
-    static int ComputeAverageRating(const std::vector<int>& ratings);
+    /// Term frequencies of document given term ids of all its words
+    static std::vector<TermFreq> MakeDocumentTerms(std::vector<TermId> word_terms);
 
-    QueryWord ParseQueryWord(const std::string_view text) const;
+    /// is_valid tells whether text is free of control characters, as reported by ForEachCheckedWord
+    QueryWord ParseQueryWord(const std::string_view text, bool is_valid) const;
 
     Query ParseQuery(const std::string_view text, bool make_unique = true) const;
 
-    double ComputeWordInverseDocumentFreq(const std::string_view word) const;
+    /// Terms of a prepared query for the current dictionary. Words unknown at preparation are looked up again
+    /// into buffer if the dictionary has grown since.
+    const Query& ResolveQuery(const PreparedQuery& prepared_query, Query& buffer) const;
+
+    /// Key of results of a parsed query in the query cache
+    static std::string MakeQueryCacheKey(const Query& query, DocumentStatus status, size_t max_count);
+
+    /// Recomputes cached log of document frequency of term
+    void UpdateTermStatistics(TermId term);
+
+    double ComputeWordInverseDocumentFreq(TermId term) const;
+
+    /// Relevance of document for plus terms with their IDFs, summed in the order of terms
+    double ComputeRelevance(const std::vector<std::pair<TermId, double>>& plus_terms, DocumentOrdinal ordinal) const;
+
+    /// Scores documents matching query. When max_count is less than the ordinal range scored by one task, documents
+    /// that cannot be among max_count most relevant of their range are skipped, so only candidates are returned.
+    template <typename ExecutionPolicy, typename DocumentPredicate, EnableForSearchPolicy<ExecutionPolicy> = true>
+    std::vector<Document> FindAllDocuments(ExecutionPolicy&& policy, const Query& query, DocumentPredicate predicate,
+                                           size_t max_count = std::numeric_limits<size_t>::max()) const;
 
-    template <typename ExecutionPolicy, typename DocumentPredicate, EnableForExecutionPolicy<ExecutionPolicy> = true>
-    std::vector<Document> FindAllDocuments(ExecutionPolicy&& policy, const Query& query, DocumentPredicate predicate) const;
+    /// Same as above with IDF of every plus term taken from inverse_document_freq(term)
+    template <typename ExecutionPolicy, typename DocumentPredicate, typename InverseDocumentFreq,
+              EnableForSearchPolicy<ExecutionPolicy> = true>
+    std::vector<Document> FindAllDocuments(ExecutionPolicy&& policy, const Query& query, DocumentPredicate predicate, size_t max_count,
+                                           InverseDocumentFreq inverse_document_freq) const;
 
     template <typename DocumentPredicate>
     std::vector<Document> FindAllDocuments(const Query& query, DocumentPredicate predicate) const;
 
+    /// At most max_count most relevant documents matching a parsed query with unique words
+    template <typename ExecutionPolicy, typename DocumentPredicate, EnableForSearchPolicy<ExecutionPolicy> = true>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const Query& query, DocumentPredicate predicate, size_t max_count) const;
+
+    /// Same as above with IDF of every plus term taken from inverse_document_freq(term)
+    template <typename ExecutionPolicy, typename DocumentPredicate, typename InverseDocumentFreq,
+              EnableForSearchPolicy<ExecutionPolicy> = true>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const Query& query, DocumentPredicate predicate, size_t max_count,
+                                           InverseDocumentFreq inverse_document_freq) const;
+
+    /// Same as above for documents with status, served from the query cache when it is enabled
+    template <typename ExecutionPolicy, EnableForSearchPolicy<ExecutionPolicy> = true>
+    std::vector<Document> FindCachedTopDocuments(ExecutionPolicy&& policy, const Query& query, DocumentStatus status, size_t max_count) const;
+
+    /// Plus words of a parsed query with unique words found in document
+    template <typename ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy> = true>
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(ExecutionPolicy&& policy, const Query& query,
+                                                                            const DocumentIdOrdinal& document) const;
+
+    /// Matches documents with ordinals ascending, a batch of ranges at a time; see MatchDocuments
+    template <typename ExecutionPolicy, typename Consumer, EnableForExecutionPolicy<ExecutionPolicy> = true>
+    void MatchOrdinals(ExecutionPolicy&& policy, const PreparedQuery& prepared_query, const std::vector<DocumentOrdinal>& ordinals,
+                       Consumer& consumer) const;
+
+    /// Matches of documents with ordinals [first, last), ascending. Plus words come sorted by text.
+    std::vector<DocumentMatch> MatchOrdinalRange(const std::vector<std::pair<std::string_view, TermId>>& plus_words,
+                                                 const std::vector<TermId>& minus_words, const DocumentOrdinal* first,
+                                                 const DocumentOrdinal* last) const;
+
+    /// MaxScore retrieval over ordinals [first, last): documents that may be among max_count most relevant ones
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopCandidates(const std::vector<std::pair<TermId, double>>& plus_terms, const std::vector<TermId>& minus_terms,
+                                            DocumentPredicate predicate, DocumentOrdinal first, DocumentOrdinal last, size_t max_count) const;
+
     static bool IsValidWord(const std::string_view word);
+};
+
+/// Query resolved to terms of the dictionary of the server that prepared it
+class SearchServer::PreparedQuery {
+   private:
+    friend class SearchServer;
+
+    Query query_;
+    /// Valid words the dictionary did not know, resolved again when it grows
+    std::vector<std::string> unknown_plus_words_;
+    std::vector<std::string> unknown_minus_words_;
+    /// Dictionary size at preparation
+    size_t term_count_ = 0;
+};
+
+/// Forward iterator over ids of present documents in insertion order; walks document slots and skips removed ones.
+/// Slots of removed documents stay until PurgeRemovedDocuments, so the iterator cannot be random access.
+class SearchServer::IdsConstIterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = int;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const int*;
+    using reference = const int&;
+
+    IdsConstIterator() = default;
+
+    reference operator*() const {
+        return document_->id;
+    }
+
+    pointer operator->() const {
+        return &document_->id;
+    }
+
+    IdsConstIterator& operator++() {
+        ++document_;
+        SkipRemoved();
+        return *this;
+    }
+
+    IdsConstIterator operator++(int) {
+        IdsConstIterator result = *this;
+        ++*this;
+        return result;
+    }
+
+    bool operator==(const IdsConstIterator& other) const {
+        return document_ == other.document_;
+    }
+
+    bool operator!=(const IdsConstIterator& other) const {
+        return document_ != other.document_;
+    }
+
+   private:
+    friend class SearchServer;
 
-    template <typename ExecutionPolicy, typename WordsContainer>
-    static void EraseFromWordToDocumentFreqs(ExecutionPolicy&& policy, int id, WordsContainer&& words,
-                                             std::map<std::string, std::map<int, double>, std::less<>>& word_to_document_freqs);
+    IdsConstIterator(const DocumentData* document, const DocumentData* end) : document_{document}, end_{end} {
+        SkipRemoved();
+    }
+
+    const DocumentData* document_ = nullptr;
+    const DocumentData* end_ = nullptr;
+
+    void SkipRemoved() {
+        while (document_ != end_ && document_->is_removed) {
+            ++document_;
+        }
+    }
 };
 
 // ----------------------------------------------------------------
 // Helper methods
 // ----------------------------------------------------------------
 
+/// Ranking order of search results: higher relevance first, higher rating first among equally relevant documents.
+/// Complete ties go by id, so the order does not depend on how documents were scored.
+inline bool IsMoreRelevant(const Document& lhs, const Document& rhs) {
+    return lhs.relevance > rhs.relevance || (std::abs(lhs.relevance - rhs.relevance) < THRESHOLD && lhs.rating > rhs.rating) ||
+           (lhs.relevance == rhs.relevance && lhs.rating == rhs.rating && lhs.id < rhs.id);
+}
+
+/// Keep only max_count most relevant documents, ordered by IsMoreRelevant.
+/// Costs O(n log max_count) instead of sorting the whole range.
+template <typename ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy> = true>
+void SelectTopDocuments(ExecutionPolicy&& policy, std::vector<Document>& documents, size_t max_count) {
+    if (documents.size() > max_count) {
+        std::partial_sort(policy, documents.begin(), documents.begin() + max_count, documents.end(), IsMoreRelevant);
+        documents.resize(max_count);
+    } else {
+        std::sort(policy, documents.begin(), documents.end(), IsMoreRelevant);
+    }
+}
+
+/// Calls function(i) for every i in [0, count), on the workers of the executor for ExecutorPolicy
+template <typename ExecutionPolicy, typename Function, EnableForSearchPolicy<ExecutionPolicy> = true>
+void ForEachIndex(ExecutionPolicy&& policy, size_t count, Function function) {
+    if constexpr (IsExecutorPolicy<ExecutionPolicy>::value) {
+        policy.executor.ParallelFor(count, function);
+    } else {
+        std::vector<size_t> indexes(count);
+        std::iota(indexes.begin(), indexes.end(), 0ul);
+        std::for_each(policy, indexes.begin(), indexes.end(), function);
+    }
+}
+
+/// Threads a search with policy may use
+template <typename ExecutionPolicy, EnableForSearchPolicy<ExecutionPolicy> = true>
+size_t GetSearchConcurrency(const ExecutionPolicy& policy) {
+    if constexpr (IsExecutorPolicy<ExecutionPolicy>::value) {
+        return policy.executor.GetWorkerCount();
+    } else if constexpr (std::is_convertible<ExecutionPolicy, std::execution::parallel_policy>::value) {
+        return std::max(1u, std::thread::hardware_concurrency());
+    } else {
+        return 1;
+    }
+}
+
 /// Exceptions safety version of AddDocument
 void AddDocument(SearchServer& search_server, int document_id, const std::string& document, DocumentStatus status = DocumentStatus::ACTUAL,
                  const std::vector<int>& ratings = {});
@@ -187,86 +691,236 @@ auto Paginate(const Container& c, size_t page_size) {
 
 template <class Container>
 SearchServer::SearchServer(const Container& stop_words) : stop_words_(MakeUniqueNonEmptyStrings(stop_words.begin(), stop_words.end())) {
-    if (any_of(stop_words_.begin(), stop_words_.end(), [](const auto word) {
-            return !IsValidWord(word);
-        })) {
-        throw std::invalid_argument("Invalid stop words"s);
-    }
+    InternStopWords();
 }
 
-template <typename ExecutionPolicy, typename DocumentPredicate, EnableForExecutionPolicy<ExecutionPolicy>>
-std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query, DocumentPredicate predicate) const {
-    auto query = ParseQuery(raw_query, false);
-    if (query.plus_words.empty()) {
-        return {};
+template <typename ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy>>
+void SearchServer::AddDocuments(ExecutionPolicy&& policy, const std::vector<NewDocument>& documents) {
+    Detach();
+
+    // Parsing only reads the dictionary, so documents are parsed and fingerprinted concurrently
+    std::vector<ParsedDocument> parsed_documents(documents.size());
+    StageTimer parse_timer(Stage::ADD_PARSE);
+    std::transform(policy, documents.begin(), documents.end(), parsed_documents.begin(), [this](const NewDocument& document) {
+        ParsedDocument parsed_document = ParseDocument(document.text);
+        if (!parsed_document.error) {
+            ComputeFingerprints(parsed_document);
+        }
+        return parsed_document;
+    });
+    parse_timer.Stop();
+
+    // Ids are checked and new words are interned in document order up to the first invalid document
+    StageTimer index_timer(Stage::ADD_INDEX);
+    const auto first_ordinal = static_cast<DocumentOrdinal>(documents_.size());
+    std::exception_ptr error;
+    for (size_t i = 0; i < documents.size(); ++i) {
+        const NewDocument& document = documents[i];
+        ParsedDocument& parsed_document = parsed_documents[i];
+        if ((document.id < 0) || (FindDocument(document.id) != nullptr)) {
+            error = std::make_exception_ptr(std::invalid_argument("Invalid document_id"s));
+            break;
+        }
+        if (parsed_document.error) {
+            error = parsed_document.error;
+            break;
+        }
+        // Every accepted document registers its hash at once, so a duplicate of an earlier one of the batch is found too
+        error = CheckDuplicate(parsed_document.content_hash);
+        if (error) {
+            break;
+        }
+        AddContentHash(parsed_document.content_hash, document.id);
+        for (const std::string_view word : parsed_document.new_words) {
+            parsed_document.terms.push_back(terms_.Intern(word));
+        }
+
+        const auto ordinal = static_cast<DocumentOrdinal>(documents_.size());
+        inverted_index_.SetDocumentLength(ordinal, parsed_document.terms.size());
+        documents_.Mutable().push_back({document.id, ComputeAverageRating(document.ratings), document.status});
+        document_band_keys_.Mutable().push_back(parsed_document.band_keys);
+        InsertDocumentId(document.id, ordinal);
+    }
+
+    const size_t added_count = documents_.size() - first_ordinal;
+    std::vector<std::vector<TermFreq>> batch_terms(added_count);
+    std::transform(policy, parsed_documents.begin(), parsed_documents.begin() + added_count, batch_terms.begin(),
+                   [](ParsedDocument& document) {
+                       return MakeDocumentTerms(std::move(document.terms));
+                   });
+    for (const auto& document_terms : batch_terms) {
+        AppendDocumentTerms(document_terms);
     }
 
-    query.MakeUnique();
-    auto matched_documents = FindAllDocuments(policy, std::move(query), predicate);
+    constexpr bool is_seq = !std::is_convertible<ExecutionPolicy, std::execution::parallel_policy>::value;
+    inverted_index_.AddBatch(first_ordinal, batch_terms, is_seq ? 1 : std::max(1u, std::thread::hardware_concurrency()));
+    index_timer.Stop();
+
+    // IDF of every term of the batch is refreshed once
+    StageTimer statistics_timer(Stage::ADD_STATISTICS);
+    log_document_freqs_.Mutable().resize(terms_.Size());
+    std::vector<bool> is_updated(terms_.Size(), false);
+    for (const auto& document_terms : batch_terms) {
+        for (const TermFreq& word : document_terms) {
+            if (!is_updated[word.term]) {
+                is_updated[word.term] = true;
+                UpdateTermStatistics(word.term);
+            }
+        }
+    }
+    log_document_count_ = std::log(static_cast<double>(GetDocumentCount()));
+    ++generation_;
+    statistics_timer.Stop();
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate, EnableForSearchPolicy<ExecutionPolicy>>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query, DocumentPredicate predicate,
+                                                     size_t max_count) const {
+    return FindTopDocuments(policy, ParseQuery(raw_query), predicate, max_count);
+}
 
-    sort(policy, matched_documents.begin(), matched_documents.end(), [](const Document& lhs, const Document& rhs) {
-        return lhs.relevance > rhs.relevance || (std::abs(lhs.relevance - rhs.relevance) < THRESHOLD && lhs.rating > rhs.rating);
+template <typename ExecutionPolicy, typename DocumentPredicate, typename InverseDocumentFreq, EnableForSearchPolicy<ExecutionPolicy>>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query, DocumentPredicate predicate,
+                                                     size_t max_count, InverseDocumentFreq inverse_document_freq) const {
+    return FindTopDocuments(policy, ParseQuery(raw_query), predicate, max_count, [this, &inverse_document_freq](const TermId term) {
+        return inverse_document_freq(terms_.GetTerm(term));
     });
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate, EnableForSearchPolicy<ExecutionPolicy>>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const Query& query, DocumentPredicate predicate,
+                                                     size_t max_count) const {
+    return FindTopDocuments(policy, query, predicate, max_count, [this](const TermId term) {
+        return ComputeWordInverseDocumentFreq(term);
+    });
+}
 
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+template <typename ExecutionPolicy, typename DocumentPredicate, typename InverseDocumentFreq, EnableForSearchPolicy<ExecutionPolicy>>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const Query& query, DocumentPredicate predicate,
+                                                     size_t max_count, InverseDocumentFreq inverse_document_freq) const {
+    if (query.plus_words.empty() || max_count == 0) {
+        return {};
+    }
+
+    auto matched_documents = FindAllDocuments(policy, query, predicate, max_count, inverse_document_freq);
+    StageTimer timer(Stage::QUERY_TOP_K);
+    // Pruned ranges leave few documents, so the executor does not get a sort of its own
+    if constexpr (IsExecutorPolicy<ExecutionPolicy>::value) {
+        SelectTopDocuments(std::execution::seq, matched_documents, max_count);
+    } else {
+        SelectTopDocuments(policy, matched_documents, max_count);
     }
 
     return matched_documents;
 }
 
-template <typename ExecutionPolicy, typename DocumentPredicate, EnableForExecutionPolicy<ExecutionPolicy>>
-std::vector<Document> SearchServer::FindAllDocuments(ExecutionPolicy&& policy, const Query& query, DocumentPredicate predicate) const {
+template <typename ExecutionPolicy, typename DocumentPredicate, EnableForSearchPolicy<ExecutionPolicy>>
+std::vector<Document> SearchServer::FindAllDocuments(ExecutionPolicy&& policy, const Query& query, DocumentPredicate predicate,
+                                                     size_t max_count) const {
+    return FindAllDocuments(policy, query, predicate, max_count, [this](const TermId term) {
+        return ComputeWordInverseDocumentFreq(term);
+    });
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate, typename InverseDocumentFreq, EnableForSearchPolicy<ExecutionPolicy>>
+std::vector<Document> SearchServer::FindAllDocuments(ExecutionPolicy&& policy, const Query& query, DocumentPredicate predicate,
+                                                     size_t max_count, InverseDocumentFreq inverse_document_freq) const {
     if (query.plus_words.empty()) {
         return {};
     }
 
-    constexpr bool is_seq = !std::is_convertible<ExecutionPolicy, std::execution::parallel_policy>::value;
-    size_t default_bucket_size = is_seq ? 1ul : std::min(word_to_document_freqs_.size(), 1000ul);
+    std::vector<TermId> minus_terms;
+    std::copy_if(query.minus_words.begin(), query.minus_words.end(), std::back_inserter(minus_terms), [this](const TermId minus_word) {
+        return inverted_index_.DocumentFreq(minus_word) > 0;
+    });
+
+    std::vector<std::pair<TermId, double>> plus_terms;
+    for (const TermId plus_word : query.plus_words) {
+        const size_t document_freq = inverted_index_.DocumentFreq(plus_word);
+        if (document_freq > 0) {
+            plus_terms.emplace_back(plus_word, inverse_document_freq(plus_word));
+        }
+    }
+    if (plus_terms.empty()) {
+        return {};
+    }
 
-    ConcurrentSet<int> cm_exclude_doc_ids{default_bucket_size * (query.minus_words.empty() ? 0ul : 1ul)};
-    std::for_each(policy, query.minus_words.begin(), query.minus_words.end(), [this, &cm_exclude_doc_ids](const std::string_view minus_word) {
-        auto ptr = word_to_document_freqs_.find(minus_word);
-        if (ptr == word_to_document_freqs_.end()) {
+    // Parallel execution splits the ordinal space into disjoint ranges, so every range is scored by exactly one thread
+    // and needs no synchronization. Exhaustive scoring uses a dense per-ordinal accumulator.
+    enum DocumentState : uint8_t { UNSEEN, EXCLUDED, REJECTED, MATCHED };
+    const size_t ordinal_count = documents_.size();
+    const size_t concurrency = GetSearchConcurrency(policy);
+    const size_t range_count = concurrency == 1 ? 1ul : std::clamp(ordinal_count / MIN_ORDINAL_RANGE_SIZE, 1ul, concurrency * 4);
+    const size_t range_size = (ordinal_count + range_count - 1) / range_count;
+
+    const bool is_pruned = max_count < range_size;
+    std::vector<DocumentState> states(is_pruned ? 0 : ordinal_count, UNSEEN);
+    std::vector<double> relevances(is_pruned ? 0 : ordinal_count, 0.0);
+
+    std::vector<std::vector<Document>> range_documents(range_count);
+    ForEachIndex(policy, range_count, [&](const size_t range_index) {
+        const auto first = static_cast<DocumentOrdinal>(range_index * range_size);
+        const auto last = static_cast<DocumentOrdinal>(std::min(ordinal_count, first + range_size));
+        if (is_pruned) {
+            range_documents[range_index] = FindTopCandidates(plus_terms, minus_terms, predicate, first, last, max_count);
             return;
         }
 
-        const auto& words = ptr->second;
+        // Every task records its own stage events, so a parallel query records one per range
+        size_t scanned_count = 0;
+        StageTimer minus_timer(Stage::QUERY_MINUS_WORDS, !minus_terms.empty());
+        for (const TermId minus_term : minus_terms) {
+            PostingCursor cursor(inverted_index_, minus_term);
+            for (cursor.Seek(first); !cursor.IsEnd() && cursor.Ordinal() < last; cursor.Next()) {
+                states[cursor.Ordinal()] = EXCLUDED;
+                ++scanned_count;
+            }
+        }
+        minus_timer.Stop();
+
+        StageTimer plus_timer(Stage::QUERY_PLUS_WORDS);
+        std::vector<DocumentOrdinal> matched;
+        for (const auto& [plus_term, inverse_document_freq] : plus_terms) {
+            PostingCursor cursor(inverted_index_, plus_term);
+            for (cursor.Seek(first); !cursor.IsEnd() && cursor.Ordinal() < last; cursor.Next()) {
+                ++scanned_count;
+                const DocumentOrdinal ordinal = cursor.Ordinal();
+                const double term_freq = cursor.TermFreq();
+                DocumentState& state = states[ordinal];
+                if (state == UNSEEN) {
+                    const DocumentData& document_data = documents_[ordinal];
+                    const bool is_matched =
+                        !document_data.is_removed && predicate(document_data.id, document_data.status, document_data.rating);
+                    state = is_matched ? MATCHED : REJECTED;
+                    if (state == MATCHED) {
+                        matched.push_back(ordinal);
+                    }
+                }
+                if (state == MATCHED) {
+                    relevances[ordinal] += term_freq * inverse_document_freq;
+                }
+            }
+        }
 
-        for (const auto& [document_id, _] : words) {
-            cm_exclude_doc_ids[document_id].ref_to_value = document_id;
+        auto& documents = range_documents[range_index];
+        documents.reserve(matched.size());
+        for (const DocumentOrdinal ordinal : matched) {
+            documents.emplace_back(documents_[ordinal].id, relevances[ordinal], documents_[ordinal].rating);
         }
+        plus_timer.Stop();
+        AddToCounter(Counter::POSTINGS_SCANNED, scanned_count);
+        AddToCounter(Counter::DOCUMENTS_SCORED, matched.size());
     });
 
-    std::set<int> exclude_doc_ids = cm_exclude_doc_ids.BuildOrdinarySet();
-    ConcurrentMap<int, double> cm_document_to_relevance(default_bucket_size * (query.plus_words.empty() ? 0ul : 1ul));
-    std::for_each(policy, query.plus_words.begin(), query.plus_words.end(),
-                  [this, &cm_document_to_relevance, predicate, &exclude_doc_ids](const std::string_view word) {
-                      auto ptr = word_to_document_freqs_.find(word);
-                      if (ptr == word_to_document_freqs_.end()) {
-                          return;
-                      }
-
-                      const auto& words = ptr->second;
-
-                      const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-                      for (const auto& [document_id, term_freq] : words) {
-                          if (exclude_doc_ids.count(document_id)) {
-                              continue;
-                          }
-                          const auto& document_data = documents_.at(document_id);
-                          if (predicate(document_id, document_data.status, document_data.rating)) {
-                              cm_document_to_relevance[document_id].ref_to_value += term_freq * inverse_document_freq;
-                          }
-                      }
-                  });
-
-    const auto docs = cm_document_to_relevance.BuildOrdinaryVector();
-    std::vector<Document> matched_documents(docs.size());
-    std::transform(policy, std::make_move_iterator(docs.begin()), std::make_move_iterator(docs.end()), matched_documents.begin(),
-                   [this](const auto item) -> Document {
-                       return {item.first, item.second, documents_.at(item.first).rating};
-                   });
+    StageTimer results_timer(Stage::QUERY_RESULTS);
+    std::vector<Document> matched_documents;
+    for (auto& documents : range_documents) {
+        matched_documents.insert(matched_documents.end(), documents.begin(), documents.end());
+    }
 
     return matched_documents;
 }
@@ -276,109 +930,448 @@ std::vector<Document> SearchServer::FindAllDocuments(const Query& query, Documen
     return FindAllDocuments(std::execution::seq, query, predicate);
 }
 
-template <typename ExecutionPolicy, typename WordsContainer>
-void SearchServer::EraseFromWordToDocumentFreqs(ExecutionPolicy&& policy, int id, WordsContainer&& words,
-                                                std::map<std::string, std::map<int, double>, std::less<>>& word_to_document_freqs) {
-    std::mutex mutex;
-    std::for_each(policy, words.begin(), words.end(), [&word_to_document_freqs, id, &policy, &mutex](const std::string_view cur_word) {
-        auto docs_ptr = word_to_document_freqs.find(cur_word);
-        if (docs_ptr == word_to_document_freqs.end() || docs_ptr->second.empty()) {
-            return;
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopCandidates(const std::vector<std::pair<TermId, double>>& plus_terms,
+                                                      const std::vector<TermId>& minus_terms, DocumentPredicate predicate,
+                                                      DocumentOrdinal first, DocumentOrdinal last, size_t max_count) const {
+    // Cursors go in ascending order of their score upper bounds. Terms whose bounds sum up below the threshold are
+    // non-essential: a document containing only them cannot reach the top, so candidates come from the other cursors.
+    std::vector<size_t> order(plus_terms.size());
+    std::iota(order.begin(), order.end(), 0ul);
+    std::vector<double> max_scores(plus_terms.size());
+    for (size_t i = 0; i < plus_terms.size(); ++i) {
+        max_scores[i] = plus_terms[i].second * inverted_index_.MaxTermFreq(plus_terms[i].first);
+    }
+    std::sort(order.begin(), order.end(), [&max_scores](size_t lhs, size_t rhs) {
+        return std::pair{max_scores[lhs], lhs} < std::pair{max_scores[rhs], rhs};
+    });
+
+    std::vector<PostingCursor> cursors;
+    cursors.reserve(order.size());
+    std::vector<double> max_score_sums(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        cursors.emplace_back(inverted_index_, plus_terms[order[i]].first);
+        cursors.back().Seek(first);
+        max_score_sums[i] = (i > 0 ? max_score_sums[i - 1] : 0.0) + max_scores[order[i]];
+    }
+    std::vector<PostingCursor> minus_cursors;
+    minus_cursors.reserve(minus_terms.size());
+    for (const TermId minus_term : minus_terms) {
+        minus_cursors.emplace_back(inverted_index_, minus_term);
+        minus_cursors.back().Seek(first);
+    }
+
+    // A document is skipped only if it is less relevant than max_count found ones by more than THRESHOLD,
+    // so ties resolved by rating are kept. Doubled THRESHOLD absorbs rounding of the estimated scores.
+    std::priority_queue<double, std::vector<double>, std::greater<double>> top_relevances;
+    double threshold = -std::numeric_limits<double>::infinity();
+    size_t first_essential = 0;
+
+    // Minus and essential postings are accumulated term-at-a-time over windows of ordinals, then every candidate of
+    // the window probes non-essential cursors from the largest bound down while it still can reach the threshold
+    enum WindowState : uint8_t { NONE, CANDIDATE, EXCLUDED };
+    constexpr size_t WINDOW_SIZE = 4096;
+    std::vector<double> scores(WINDOW_SIZE, 0.0);
+    std::vector<WindowState> states(WINDOW_SIZE, NONE);
+    std::vector<Document> documents;
+    // Minus and plus postings interleave window by window, so the whole loop is timed once as QUERY_PLUS_WORDS;
+    // timers per window would read the clock several times a window
+    StageTimer plus_timer(Stage::QUERY_PLUS_WORDS);
+    size_t scanned_count = 0;
+    size_t scored_count = 0;
+    while (true) {
+        DocumentOrdinal window_first = last;
+        for (size_t i = first_essential; i < cursors.size(); ++i) {
+            if (!cursors[i].IsEnd()) {
+                window_first = std::min(window_first, cursors[i].Ordinal());
+            }
+        }
+        if (window_first >= last) {
+            break;
+        }
+        const auto window_last = static_cast<DocumentOrdinal>(std::min<size_t>(last, window_first + WINDOW_SIZE));
+        const size_t window_first_essential = first_essential;
+
+        for (PostingCursor& cursor : minus_cursors) {
+            for (cursor.Seek(window_first); !cursor.IsEnd() && cursor.Ordinal() < window_last; cursor.Next()) {
+                states[cursor.Ordinal() - window_first] = EXCLUDED;
+                ++scanned_count;
+            }
+        }
+        for (size_t i = window_first_essential; i < cursors.size(); ++i) {
+            const double idf = plus_terms[order[i]].second;
+            for (PostingCursor& cursor = cursors[i]; !cursor.IsEnd() && cursor.Ordinal() < window_last; cursor.Next()) {
+                ++scanned_count;
+                const size_t offset = cursor.Ordinal() - window_first;
+                if (states[offset] == NONE) {
+                    states[offset] = CANDIDATE;
+                }
+                scores[offset] += cursor.TermFreq() * idf;
+            }
         }
-        auto ptr = find_if(policy, docs_ptr->second.begin(), docs_ptr->second.end(), [id](const std::pair<int, double>& item) {
-            return item.first == id;
-        });
-        ASSERT(ptr != docs_ptr->second.end());
-        docs_ptr->second.erase(ptr);
 
-        if (docs_ptr->second.empty()) {
-            std::lock_guard<std::mutex> lock(mutex);
-            word_to_document_freqs.erase(docs_ptr);
+        for (size_t offset = 0; offset < window_last - window_first; ++offset) {
+            const WindowState state = std::exchange(states[offset], NONE);
+            double score = std::exchange(scores[offset], 0.0);
+            if (state != CANDIDATE) {
+                continue;
+            }
+            const auto ordinal = static_cast<DocumentOrdinal>(window_first + offset);
+            const DocumentData& document_data = documents_[ordinal];
+            const double non_essential_max_score = window_first_essential > 0 ? max_score_sums[window_first_essential - 1] : 0.0;
+            if (score + non_essential_max_score < threshold || document_data.is_removed ||
+                !predicate(document_data.id, document_data.status, document_data.rating)) {
+                continue;
+            }
+
+            bool is_skipped = false;
+            for (size_t i = window_first_essential; i-- > 0;) {
+                if (score + max_score_sums[i] < threshold) {
+                    is_skipped = true;
+                    break;
+                }
+                const double idf = plus_terms[order[i]].second;
+                const double rest_max_score = i > 0 ? max_score_sums[i - 1] : 0.0;
+                if (score + rest_max_score + idf * cursors[i].MaxTermFreq(ordinal) < threshold) {
+                    continue;
+                }
+                cursors[i].Seek(ordinal);
+                ++scanned_count;
+                if (!cursors[i].IsEnd() && cursors[i].Ordinal() == ordinal) {
+                    score += cursors[i].TermFreq() * idf;
+                }
+            }
+            if (is_skipped || score < threshold) {
+                continue;
+            }
+
+            const double relevance = ComputeRelevance(plus_terms, ordinal);
+            ++scored_count;
+            documents.emplace_back(document_data.id, relevance, document_data.rating);
+            top_relevances.push(relevance);
+            if (top_relevances.size() > max_count) {
+                top_relevances.pop();
+            }
+            if (top_relevances.size() == max_count) {
+                threshold = top_relevances.top() - 2 * THRESHOLD;
+                while (first_essential < cursors.size() && max_score_sums[first_essential] < threshold) {
+                    ++first_essential;
+                }
+            }
         }
-    });
+    }
+    plus_timer.Stop();
+    AddToCounter(Counter::POSTINGS_SCANNED, scanned_count);
+    AddToCounter(Counter::DOCUMENTS_SCORED, scored_count);
+
+    documents.erase(std::remove_if(documents.begin(), documents.end(),
+                                   [threshold](const Document& document) {
+                                       return document.relevance < threshold;
+                                   }),
+                    documents.end());
+    return documents;
 }
 
 template <typename ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy>>
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(ExecutionPolicy&& policy, const std::string_view raw_query,
                                                                                       int document_id) const {
-    auto word_freqs_ptr = document_to_words_freqs_.find(document_id);
-    if (word_freqs_ptr == document_to_words_freqs_.end()) {
+    const DocumentIdOrdinal* document = FindDocument(document_id);
+    if (document == nullptr) {
         throw std::out_of_range("No document with id: "s + std::to_string(document_id));
     }
+    return MatchDocument(policy, ParseQuery(raw_query), *document);
+}
 
-    const auto& words = word_freqs_ptr->second;
-
-    Query query = ParseQuery(raw_query, false);
-    std::tuple<std::vector<std::string_view>, DocumentStatus> result{{}, documents_.at(document_id).status};
+template <typename ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy>>
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(ExecutionPolicy&& policy, const PreparedQuery& query,
+                                                                                      int document_id) const {
+    const DocumentIdOrdinal* document = FindDocument(document_id);
+    if (document == nullptr) {
+        throw std::out_of_range("No document with id: "s + std::to_string(document_id));
+    }
+    Query buffer;
+    return MatchDocument(policy, ResolveQuery(query, buffer), *document);
+}
 
-    query.MakeUnique(query.minus_words);
-    if (std::any_of(query.minus_words.begin(), query.minus_words.end(), [&words](const auto minus_word) {
-            return words.count(minus_word);
+template <typename ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy>>
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(ExecutionPolicy&& policy, const Query& query,
+                                                                                      const DocumentIdOrdinal& document) const {
+    const auto words = GetDocumentTerms(document.ordinal);
+    const DocumentStatus status = documents_[document.ordinal].status;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> result{std::vector<std::string_view>{}, status};
+
+    if (std::any_of(query.minus_words.begin(), query.minus_words.end(), [words](const TermId minus_word) {
+            return ContainsTerm(words, minus_word);
         })) {
         return result;
     }
 
-    query.MakeUnique(query.plus_words);
-
     auto& matched_words = std::get<0>(result);
     matched_words.reserve(query.plus_words.size());
     std::mutex mutex;
-    std::for_each(policy, query.plus_words.begin(), query.plus_words.end(), [&mutex, &words, &matched_words](const auto plus_word) {
-        if (words.count(plus_word)) {
+    std::for_each(policy, query.plus_words.begin(), query.plus_words.end(), [this, &mutex, words, &matched_words](const TermId plus_word) {
+        if (ContainsTerm(words, plus_word)) {
             std::lock_guard<std::mutex> lock_guard(mutex);
-            matched_words.push_back(plus_word);
+            matched_words.push_back(terms_.GetTerm(plus_word));
         }
     });
+    std::sort(matched_words.begin(), matched_words.end());
 
     return result;
 }
 
+template <typename ExecutionPolicy, typename Consumer, EnableForExecutionPolicy<ExecutionPolicy>>
+void SearchServer::MatchDocuments(ExecutionPolicy&& policy, const PreparedQuery& query, Consumer consumer) const {
+    std::vector<DocumentOrdinal> ordinals;
+    ordinals.reserve(GetDocumentCount());
+    for (size_t ordinal = 0; ordinal < documents_.size(); ++ordinal) {
+        if (!documents_[ordinal].is_removed) {
+            ordinals.push_back(static_cast<DocumentOrdinal>(ordinal));
+        }
+    }
+    MatchOrdinals(policy, query, ordinals, consumer);
+}
+
+template <typename Consumer>
+void SearchServer::MatchDocuments(const PreparedQuery& query, Consumer consumer) const {
+    MatchDocuments(std::execution::seq, query, consumer);
+}
+
+template <typename ExecutionPolicy, typename Consumer, EnableForExecutionPolicy<ExecutionPolicy>>
+void SearchServer::MatchDocuments(ExecutionPolicy&& policy, const PreparedQuery& query, const std::vector<int>& document_ids,
+                                  Consumer consumer) const {
+    std::vector<DocumentOrdinal> ordinals;
+    ordinals.reserve(document_ids.size());
+    for (const int document_id : document_ids) {
+        const DocumentIdOrdinal* document = FindDocument(document_id);
+        if (document == nullptr) {
+            throw std::out_of_range("No document with id: "s + std::to_string(document_id));
+        }
+        ordinals.push_back(document->ordinal);
+    }
+    std::sort(policy, ordinals.begin(), ordinals.end());
+    ordinals.erase(std::unique(ordinals.begin(), ordinals.end()), ordinals.end());
+    MatchOrdinals(policy, query, ordinals, consumer);
+}
+
+template <typename Consumer>
+void SearchServer::MatchDocuments(const PreparedQuery& query, const std::vector<int>& document_ids, Consumer consumer) const {
+    MatchDocuments(std::execution::seq, query, document_ids, consumer);
+}
+
+template <typename ExecutionPolicy, typename Consumer, EnableForExecutionPolicy<ExecutionPolicy>>
+void SearchServer::MatchOrdinals(ExecutionPolicy&& policy, const PreparedQuery& prepared_query, const std::vector<DocumentOrdinal>& ordinals,
+                                 Consumer& consumer) const {
+    Query buffer;
+    const Query& query = ResolveQuery(prepared_query, buffer);
+    // Words of every document come in the order MatchDocument sorts them in
+    std::vector<std::pair<std::string_view, TermId>> plus_words;
+    plus_words.reserve(query.plus_words.size());
+    for (const TermId term : query.plus_words) {
+        plus_words.emplace_back(terms_.GetTerm(term), term);
+    }
+    std::sort(plus_words.begin(), plus_words.end());
+
+    constexpr bool is_seq = !std::is_convertible<ExecutionPolicy, std::execution::parallel_policy>::value;
+    const size_t batch_size = MATCH_RANGE_SIZE * (is_seq ? 1 : std::max(1u, std::thread::hardware_concurrency()) * 2);
+    std::vector<size_t> range_starts;
+    std::vector<std::vector<DocumentMatch>> range_matches;
+    for (size_t batch_start = 0; batch_start < ordinals.size(); batch_start += batch_size) {
+        const size_t batch_end = std::min(batch_start + batch_size, ordinals.size());
+        range_starts.clear();
+        for (size_t start = batch_start; start < batch_end; start += MATCH_RANGE_SIZE) {
+            range_starts.push_back(start);
+        }
+        range_matches.resize(range_starts.size());
+        std::transform(policy, range_starts.begin(), range_starts.end(), range_matches.begin(),
+                       [this, &plus_words, &query, &ordinals, batch_end](const size_t start) {
+                           return MatchOrdinalRange(plus_words, query.minus_words, ordinals.data() + start,
+                                                    ordinals.data() + std::min(start + MATCH_RANGE_SIZE, batch_end));
+                       });
+        for (const auto& matches : range_matches) {
+            for (const DocumentMatch& match : matches) {
+                consumer(match);
+            }
+        }
+    }
+}
+
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments(const std::string_view raw_query, DocumentPredicate predicate) const {
-    return FindTopDocuments(std::execution::seq, raw_query, predicate);
+std::vector<Document> SearchServer::FindTopDocuments(const std::string_view raw_query, DocumentPredicate predicate, size_t max_count) const {
+    return FindTopDocuments(std::execution::seq, raw_query, predicate, max_count);
 }
 
-template <class ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy>>
-std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query, DocumentStatus status) const {
-    return FindTopDocuments(policy, raw_query, [status](int id, DocumentStatus doc_status, [[maybe_unused]] int rating) -> bool {
+template <class ExecutionPolicy, EnableForSearchPolicy<ExecutionPolicy>>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query, DocumentStatus status,
+                                                     size_t max_count) const {
+    return FindCachedTopDocuments(policy, ParseQuery(raw_query), status, max_count);
+}
+
+template <class ExecutionPolicy, EnableForSearchPolicy<ExecutionPolicy>>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query, DocumentStatus status,
+                                                     size_t max_count) const {
+    Query buffer;
+    return FindCachedTopDocuments(policy, ResolveQuery(query, buffer), status, max_count);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate, EnableForSearchPolicy<ExecutionPolicy>>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query, DocumentPredicate predicate,
+                                                     size_t max_count) const {
+    Query buffer;
+    return FindTopDocuments(policy, ResolveQuery(query, buffer), predicate, max_count);
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(const PreparedQuery& query, DocumentPredicate predicate, size_t max_count) const {
+    return FindTopDocuments(std::execution::seq, query, predicate, max_count);
+}
+
+template <typename ExecutionPolicy, EnableForSearchPolicy<ExecutionPolicy>>
+std::vector<Document> SearchServer::FindCachedTopDocuments(ExecutionPolicy&& policy, const Query& query, DocumentStatus status,
+                                                           size_t max_count) const {
+    const auto predicate = [status]([[maybe_unused]] int id, DocumentStatus doc_status, [[maybe_unused]] int rating) -> bool {
         return (doc_status == status);
-    });
+    };
+    if (!query_cache_.IsEnabled()) {
+        return FindTopDocuments(policy, query, predicate, max_count);
+    }
+
+    // Parsing resolves words to sorted unique terms, so differently written equal queries share an entry
+    const std::string key = MakeQueryCacheKey(query, status, max_count);
+    if (auto documents = query_cache_.Find(key, generation_)) {
+        return std::move(*documents);
+    }
+    auto documents = FindTopDocuments(policy, query, predicate, max_count);
+    query_cache_.Insert(key, generation_, documents);
+    return documents;
 }
 
-template <class ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy>>
+template <class ExecutionPolicy, EnableForSearchPolicy<ExecutionPolicy>>
 std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query) const {
     return FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
 }
 
+template <typename Visitor>
+void SearchServer::ForEachDocumentWord(int document_id, Visitor visitor) const {
+    const DocumentIdOrdinal* document = FindDocument(document_id);
+    if (document == nullptr) {
+        return;
+    }
+    for (const TermFreq& word : GetDocumentTerms(document->ordinal)) {
+        visitor(terms_.GetTerm(word.term));
+    }
+}
+
 template <class ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy>>
 void SearchServer::RemoveDocument(ExecutionPolicy&& policy, int document_id) {
-    if (document_ids_.empty() || !documents_.count(document_id)) {
+    RemoveDocuments(policy, std::vector<int>{document_id});
+}
+
+template <typename ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy>>
+void SearchServer::RemoveDocuments(ExecutionPolicy&& policy, const std::vector<int>& document_ids) {
+    // Id entries and postings stay until PurgeRemovedDocuments; FindDocument and queries skip removed documents
+    std::vector<TermId> removed_terms;
+    size_t removed_count = 0;
+    StageTimer mark_timer(Stage::REMOVE_MARK);
+    for (const int document_id : document_ids) {
+        const DocumentIdOrdinal* document = FindDocument(document_id);
+        if (document == nullptr) {
+            continue;
+        }
+        const DocumentOrdinal ordinal = document->ordinal;
+        Detach();
+        word_frequencies_.Erase(document_id);
+        const auto words = GetDocumentTerms(ordinal);
+        RemoveContentHash(ComputeContentHash(words), document_id);
+        documents_.Mutable()[ordinal].is_removed = true;
+        for (const TermFreq& word : words) {
+            removed_terms.push_back(word.term);
+        }
+        ++removed_count;
+    }
+    if (removed_count == 0) {
         return;
     }
+    document_count_ -= static_cast<int>(removed_count);
+    pending_removal_count_ += removed_count;
+    mark_timer.Stop();
+
+    StageTimer statistics_timer(Stage::REMOVE_STATISTICS);
+    // Terms of one document are sorted and unique already; those of many are counted in runs
+    if (removed_count > 1) {
+        std::sort(policy, removed_terms.begin(), removed_terms.end());
+    }
+    std::vector<size_t> run_starts;
+    for (size_t i = 0; i < removed_terms.size(); ++i) {
+        if (i == 0 || removed_terms[i] != removed_terms[i - 1]) {
+            run_starts.push_back(i);
+        }
+    }
+    std::for_each(policy, run_starts.begin(), run_starts.end(), [this, &removed_terms](const size_t start) {
+        const TermId term = removed_terms[start];
+        const size_t end = std::find_if(removed_terms.begin() + start, removed_terms.end(),
+                                        [term](const TermId other) {
+                                            return other != term;
+                                        }) -
+                           removed_terms.begin();
+        inverted_index_.MarkRemoved(term, static_cast<uint32_t>(end - start));
+        UpdateTermStatistics(term);
+    });
+    log_document_count_ = std::log(static_cast<double>(GetDocumentCount()));
+    ++generation_;
+}
 
-    auto doc_words_ptr = document_to_words_freqs_.find(document_id);
-    if (doc_words_ptr == document_to_words_freqs_.end() || word_to_document_freqs_.empty()) {
-        return;
+template <typename ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy>>
+void SearchServer::RemoveDuplicates(ExecutionPolicy&& policy) {
+    Detach();
+    std::vector<int> duplicate_ids;
+    for (const auto& [_, ids] : hash_content_) {
+        duplicate_ids.insert(duplicate_ids.end(), std::next(ids.begin()), ids.end());
     }
+    std::sort(policy, duplicate_ids.begin(), duplicate_ids.end());
+    RemoveDocuments(policy, duplicate_ids);
+    ReportDuplicates(duplicate_ids);
+}
 
-    std::set<std::string> exclude_words{};
-    auto hash = BuildHash(doc_words_ptr->second, exclude_words);
-    ASSERT(hash_content_.count(hash));
-    auto& hash_ids = hash_content_[hash];
-    hash_ids.erase(document_id);
-    if (hash_ids.empty()) {
-        hash_content_.erase(hash);
+template <typename ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy>>
+std::vector<std::vector<int>> SearchServer::FindNearDuplicates(ExecutionPolicy&& policy, double min_similarity) const {
+    if (!(min_similarity > 0.0 && min_similarity <= 1.0)) {
+        throw std::invalid_argument("Similarity threshold must be in (0, 1]"s);
     }
+    std::vector<size_t> bands(MIN_HASH_BANDS);
+    std::iota(bands.begin(), bands.end(), 0);
+    std::vector<std::vector<OrdinalPair>> band_candidates(MIN_HASH_BANDS);
+    std::transform(policy, bands.begin(), bands.end(), band_candidates.begin(), [this](const size_t band) {
+        return FindBandCandidates(band);
+    });
+    std::vector<OrdinalPair> candidates;
+    for (const auto& pairs : band_candidates) {
+        candidates.insert(candidates.end(), pairs.begin(), pairs.end());
+    }
+    // Pairs sharing several bands are compared once
+    std::sort(policy, candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
 
-    std::vector<std::string_view> words{doc_words_ptr->second.size()};
-    std::transform(policy, doc_words_ptr->second.begin(), doc_words_ptr->second.end(), words.begin(), [](const auto& item) {
-        return item.first;
+    std::vector<char> is_similar(candidates.size());
+    std::transform(policy, candidates.begin(), candidates.end(), is_similar.begin(), [this, min_similarity](const OrdinalPair& pair) {
+        return IsNearDuplicate(pair.first, pair.second, min_similarity);
     });
+    std::vector<OrdinalPair> similar_pairs;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        if (is_similar[i]) {
+            similar_pairs.push_back(candidates[i]);
+        }
+    }
+    return MakeNearDuplicateClusters(similar_pairs);
+}
 
-    auto doc_id_ptr = std::find(document_ids_.begin(), document_ids_.end(), document_id);
-    ASSERT(doc_id_ptr != document_ids_.end());
-    document_ids_.erase(doc_id_ptr);
-    documents_.erase(document_id);
-    document_to_words_freqs_.erase(doc_words_ptr);
-    EraseFromWordToDocumentFreqs(policy, document_id, std::move(words), word_to_document_freqs_);
-}
\ No newline at end of file
+template <typename ExecutionPolicy, EnableForExecutionPolicy<ExecutionPolicy>>
+void SearchServer::RemoveNearDuplicates(ExecutionPolicy&& policy, double min_similarity) {
+    std::vector<int> duplicate_ids;
+    for (const auto& ids : FindNearDuplicates(policy, min_similarity)) {
+        duplicate_ids.insert(duplicate_ids.end(), std::next(ids.begin()), ids.end());
+    }
+    std::sort(policy, duplicate_ids.begin(), duplicate_ids.end());
+    RemoveDocuments(policy, duplicate_ids);
+    ReportDuplicates(duplicate_ids);
+}
@@ -0,0 +1,99 @@
+#include "sharded_search_server.h"
+
+#include <cassert>
+#include <cmath>
+#include <map>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "string_processing.h"
+
+using namespace std;
+
+// ----------------------------------------------------------------
+// ShardedSearchServer implementation
+// ----------------------------------------------------------------
+
+ShardedSearchServer::ShardedSearchServer(const string_view stop_words_text, size_t shard_count)
+    : ShardedSearchServer(SplitIntoWords(stop_words_text), shard_count) {}
+
+ShardedSearchServer::ShardedSearchServer(const string& stop_words_text, size_t shard_count)
+    : ShardedSearchServer(SplitIntoWords(stop_words_text), shard_count) {}
+
+void ShardedSearchServer::AddDocument(int document_id, const string_view document, DocumentStatus status, const vector<int>& ratings) {
+    SearchServer& shard = GetShard(document_id);
+    shard.AddDocument(document_id, document, status, ratings);
+    UpdateDocumentFreqs(shard, document_id, 1);
+    log_document_count_ = log(static_cast<double>(GetDocumentCount()));
+}
+
+void ShardedSearchServer::RemoveDocument(int document_id) {
+    SearchServer& shard = GetShard(document_id);
+    UpdateDocumentFreqs(shard, document_id, -1);
+    shard.RemoveDocument(document_id);
+    log_document_count_ = log(static_cast<double>(GetDocumentCount()));
+}
+
+vector<Document> ShardedSearchServer::FindTopDocuments(const string_view raw_query, DocumentStatus status, size_t max_count) const {
+    return FindTopDocuments(
+        raw_query,
+        [status](int, DocumentStatus document_status, int) {
+            return document_status == status;
+        },
+        max_count);
+}
+
+vector<Document> ShardedSearchServer::FindTopDocuments(const string_view raw_query) const {
+    return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
+}
+
+tuple<vector<string_view>, DocumentStatus> ShardedSearchServer::MatchDocument(const string_view raw_query, int document_id) const {
+    return GetShard(document_id).MatchDocument(raw_query, document_id);
+}
+
+const map<string_view, double>& ShardedSearchServer::GetWordFrequencies(int document_id) const {
+    return GetShard(document_id).GetWordFrequencies(document_id);
+}
+
+int ShardedSearchServer::GetDocumentCount() const {
+    return accumulate(shards_.begin(), shards_.end(), 0, [](int count, const SearchServer& shard) {
+        return count + shard.GetDocumentCount();
+    });
+}
+
+size_t ShardedSearchServer::GetShardCount() const {
+    return shards_.size();
+}
+
+const SearchServer& ShardedSearchServer::GetShard(int document_id) const {
+    // Negative ids go to some shard too, which rejects them as SearchServer does
+    return shards_[static_cast<unsigned>(document_id) % shards_.size()];
+}
+
+SearchServer& ShardedSearchServer::GetShard(int document_id) {
+    return shards_[static_cast<unsigned>(document_id) % shards_.size()];
+}
+
+void ShardedSearchServer::UpdateDocumentFreqs(const SearchServer& shard, int document_id, int delta) {
+    // Words come from the forward index of the shard, so the document is not tokenized again
+    shard.ForEachDocumentWord(document_id, [this, delta](const string_view word) {
+        const TermId term = terms_.Intern(word);
+        if (term >= document_freqs_.size()) {
+            document_freqs_.resize(term + 1, 0);
+            log_document_freqs_.resize(term + 1, 0.0);
+        }
+        document_freqs_[term] += delta;
+        log_document_freqs_[term] = document_freqs_[term] > 0 ? log(static_cast<double>(document_freqs_[term])) : 0.0;
+    });
+}
+
+double ShardedSearchServer::ComputeWordInverseDocumentFreq(const string_view word) const {
+    // Same expression as the cached IDF of SearchServer
+    const TermId term = terms_.Find(word);
+    assert(term != NO_TERM && document_freqs_[term] > 0);
+    return log_document_count_ - log_document_freqs_[term];
+}
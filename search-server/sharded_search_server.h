@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <execution>
+#include <map>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "document.h"
+#include "search_server.h"
+#include "term_dictionary.h"
+
+/// Search server splitting documents across shards by id. A query runs on all shards in parallel and their top
+/// documents are merged.
+///
+/// A document is tokenized by its own shard only, so every shard keeps a dictionary of its own documents. The server
+/// keeps one dictionary of all words with their document frequencies, updated from the words of every added and
+/// removed document, and shards rank documents with IDF computed from it and the total document count. Relevance
+/// matches a single SearchServer holding all the documents up to rounding, since shards add up term contributions
+/// in the order of their own term ids.
+class ShardedSearchServer {
+   public:
+    template <class Container>
+    ShardedSearchServer(const Container& stop_words, size_t shard_count);
+
+    ShardedSearchServer(const std::string_view stop_words_text, size_t shard_count);
+
+    ShardedSearchServer(const std::string& stop_words_text, size_t shard_count);
+
+    void AddDocument(int document_id, const std::string_view document, DocumentStatus status = DocumentStatus::ACTUAL,
+                     const std::vector<int>& ratings = {});
+
+    void RemoveDocument(int document_id);
+
+    /// Find at most max_count most matched documents over all shards
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentPredicate predicate,
+                                           size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentStatus status,
+                                           size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query) const;
+
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::string_view raw_query, int document_id) const;
+
+    const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
+
+    /// Total number of documents in all shards
+    int GetDocumentCount() const;
+
+    size_t GetShardCount() const;
+
+   private:
+    std::vector<SearchServer> shards_;
+    /// Words of all documents and the number of present documents having each, indexed by term id
+    TermDictionary terms_;
+    std::vector<int> document_freqs_;
+    /// Cached IDF parts as in SearchServer: log of the total document count and logs of document frequencies by
+    /// term id, refreshed by every mutation, so queries never call log
+    double log_document_count_ = 0.0;
+    std::vector<double> log_document_freqs_;
+
+    const SearchServer& GetShard(int document_id) const;
+
+    SearchServer& GetShard(int document_id);
+
+    /// Adds delta to the document frequencies of the words of a present document and refreshes their logs
+    void UpdateDocumentFreqs(const SearchServer& shard, int document_id, int delta);
+
+    /// IDF of word over all shards; the word must be in a present document
+    double ComputeWordInverseDocumentFreq(const std::string_view word) const;
+};
+
+template <class Container>
+ShardedSearchServer::ShardedSearchServer(const Container& stop_words, size_t shard_count) : shards_(shard_count, SearchServer(stop_words)) {
+    if (shard_count == 0) {
+        throw std::invalid_argument("Shard count must be positive"s);
+    }
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> ShardedSearchServer::FindTopDocuments(const std::string_view raw_query, DocumentPredicate predicate,
+                                                            size_t max_count) const {
+    const auto inverse_document_freq = [this](const std::string_view word) {
+        return ComputeWordInverseDocumentFreq(word);
+    };
+
+    // Every shard parses the query against its own dictionary; an invalid query fails on all of them alike
+    std::vector<std::vector<Document>> shard_documents(shards_.size());
+    std::vector<std::exception_ptr> errors(shards_.size());
+    ForEachIndex(std::execution::par, shards_.size(), [&](const size_t index) {
+        try {
+            shard_documents[index] = shards_[index].FindTopDocuments(std::execution::seq, raw_query, predicate, max_count, inverse_document_freq);
+        } catch (...) {
+            errors[index] = std::current_exception();
+        }
+    });
+    for (const std::exception_ptr& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    std::vector<Document> matched_documents;
+    for (auto& documents : shard_documents) {
+        matched_documents.insert(matched_documents.end(), documents.begin(), documents.end());
+    }
+    SelectTopDocuments(std::execution::seq, matched_documents, max_count);
+    return matched_documents;
+}
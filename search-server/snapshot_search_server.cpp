@@ -0,0 +1,138 @@
+#include "snapshot_search_server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <execution>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// ----------------------------------------------------------------
+// SnapshotSearchServer::Snapshot implementation
+// ----------------------------------------------------------------
+
+SnapshotSearchServer::Snapshot::Snapshot(Snapshot&& other) noexcept : server_{other.server_}, readers_{exchange(other.readers_, nullptr)} {}
+
+SnapshotSearchServer::Snapshot::~Snapshot() {
+    if (readers_ != nullptr) {
+        readers_->fetch_sub(1, memory_order_release);
+    }
+}
+
+// ----------------------------------------------------------------
+// SnapshotSearchServer implementation
+// ----------------------------------------------------------------
+
+SnapshotSearchServer::SnapshotSearchServer(const SearchServer& search_server) : servers_{search_server, search_server} {}
+
+SnapshotSearchServer::Snapshot SnapshotSearchServer::GetSnapshot() const {
+    while (true) {
+        const size_t index = published_.load();
+        readers_[index].count.fetch_add(1);
+        // Publish switches the index before it checks the counter, so a reader that still sees its copy published
+        // after registering is waited for
+        if (published_.load() == index) {
+            return Snapshot(servers_[index], readers_[index].count);
+        }
+        readers_[index].count.fetch_sub(1, memory_order_release);
+    }
+}
+
+int SnapshotSearchServer::GetDocumentCount() const {
+    return GetSnapshot()->GetDocumentCount();
+}
+
+void SnapshotSearchServer::AddDocument(int document_id, string_view document, DocumentStatus status, const vector<int>& ratings) {
+    Apply([document_id, text = string(document), status, ratings](SearchServer& server) {
+        server.AddDocument(document_id, text, status, ratings);
+    });
+}
+
+void SnapshotSearchServer::AddDocuments(const vector<NewDocument>& documents) {
+    vector<string> texts;
+    texts.reserve(documents.size());
+    for (const NewDocument& document : documents) {
+        texts.emplace_back(document.text);
+    }
+    // Texts are owned by the mutation, so the batch referring to them is rebuilt on every application
+    Apply([documents, texts = move(texts)](SearchServer& server) {
+        vector<NewDocument> batch = documents;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            batch[i].text = texts[i];
+        }
+        server.AddDocuments(execution::par, batch);
+    });
+}
+
+void SnapshotSearchServer::RemoveDocument(int document_id) {
+    Apply([document_id](SearchServer& server) {
+        server.RemoveDocument(document_id);
+    });
+}
+
+void SnapshotSearchServer::RemoveDuplicates() {
+    lock_guard guard(writer_mutex_);
+    SearchServer& server = GetWritable();
+
+    // Duplicates are reported once, the other copy just removes the same documents
+    vector<int> ids_before(server.begin(), server.end());
+    server.RemoveDuplicates();
+    vector<int> ids_after(server.begin(), server.end());
+    sort(ids_before.begin(), ids_before.end());
+    sort(ids_after.begin(), ids_after.end());
+    vector<int> removed_ids;
+    set_difference(ids_before.begin(), ids_before.end(), ids_after.begin(), ids_after.end(), back_inserter(removed_ids));
+
+    pending_.push_back([removed_ids = move(removed_ids)](SearchServer& server) {
+        for (const int id : removed_ids) {
+            server.RemoveDocument(id);
+        }
+    });
+}
+
+void SnapshotSearchServer::CompressIndex() {
+    Apply([](SearchServer& server) {
+        server.CompressIndex();
+    });
+}
+
+void SnapshotSearchServer::PurgeRemovedDocuments() {
+    Apply([](SearchServer& server) {
+        server.PurgeRemovedDocuments();
+    });
+}
+
+void SnapshotSearchServer::Publish() {
+    lock_guard guard(writer_mutex_);
+    const size_t previous = published_.load();
+    published_.store(1 - previous);
+    while (readers_[previous].count.load(memory_order_acquire) > 0) {
+        this_thread::yield();
+    }
+
+    for (const Mutation& mutation : pending_) {
+        // Both copies are in the same state, so a mutation fails here exactly as it failed on the other copy
+        try {
+            mutation(servers_[previous]);
+        } catch (const exception&) {
+        }
+    }
+    pending_.clear();
+}
+
+SearchServer& SnapshotSearchServer::GetWritable() {
+    return servers_[1 - published_.load()];
+}
+
+void SnapshotSearchServer::Apply(Mutation mutation) {
+    lock_guard guard(writer_mutex_);
+    pending_.push_back(mutation);
+    mutation(GetWritable());
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "document.h"
+#include "search_server.h"
+
+/// Search server that serves queries while documents are being added and removed.
+///
+/// Two copies of the server are kept (left-right scheme). Readers enter the published copy by bumping its reader
+/// counter and never wait for writers. Writers mutate the other copy under a mutex and remember the mutations;
+/// Publish switches the copies, waits for readers to leave the previous one and replays the mutations on it.
+class SnapshotSearchServer {
+   public:
+    /// Read access to the published copy. Writers do not touch the copy while any snapshot of it is alive.
+    class Snapshot {
+       public:
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+
+        Snapshot(Snapshot&& other) noexcept;
+
+        ~Snapshot();
+
+        const SearchServer& operator*() const {
+            return *server_;
+        }
+
+        const SearchServer* operator->() const {
+            return server_;
+        }
+
+       private:
+        friend class SnapshotSearchServer;
+
+        Snapshot(const SearchServer& server, std::atomic_size_t& readers) : server_{&server}, readers_{&readers} {}
+
+        const SearchServer* server_;
+        std::atomic_size_t* readers_;
+    };
+
+    explicit SnapshotSearchServer(const SearchServer& search_server);
+
+    /// Published copy of the server. The holder must not call Publish from the same thread.
+    Snapshot GetSnapshot() const;
+
+    template <typename... Args>
+    std::vector<Document> FindTopDocuments(Args&&... args) const {
+        return GetSnapshot()->FindTopDocuments(std::forward<Args>(args)...);
+    }
+
+    /// Matched words stay valid until the server is destroyed: mutations never move words of the dictionary
+    template <typename... Args>
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(Args&&... args) const {
+        return GetSnapshot()->MatchDocument(std::forward<Args>(args)...);
+    }
+
+    /// Number of documents in the published copy
+    int GetDocumentCount() const;
+
+    // Mutations are visible to readers after the next Publish
+
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status = DocumentStatus::ACTUAL,
+                     const std::vector<int>& ratings = {});
+
+    void AddDocuments(const std::vector<NewDocument>& documents);
+
+    void RemoveDocument(int document_id);
+
+    void RemoveDuplicates();
+
+    void CompressIndex();
+
+    /// Purges removed documents in the writable copy while readers keep querying the published one
+    void PurgeRemovedDocuments();
+
+    /// Makes all mutations visible to readers. Waits for readers of the previously published copy.
+    void Publish();
+
+   private:
+    using Mutation = std::function<void(SearchServer&)>;
+
+    /// Reader counter on its own cache line, so readers of one copy do not slow down the other
+    struct alignas(64) ReaderCounter {
+        std::atomic_size_t count{0};
+    };
+
+    std::array<SearchServer, 2> servers_;
+    mutable std::array<ReaderCounter, 2> readers_;
+    std::atomic_size_t published_{0};
+
+    std::mutex writer_mutex_;
+    /// Mutations applied to the writable copy but not to the published one
+    std::vector<Mutation> pending_;
+
+    SearchServer& GetWritable();
+
+    /// Applies mutation to the writable copy and keeps it for the other one
+    void Apply(Mutation mutation);
+};
@@ -3,27 +3,70 @@
 #include <algorithm>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
 #include <execution>
+#include <iterator>
 #include <numeric>
 #include <string>
 #include <string_view>
 #include <vector>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 using namespace std;
 
-vector<string_view> SplitIntoWords(string_view str) {
-    if (str.empty()) {
-        return {};
+namespace {
+
+#if defined(__x86_64__)
+
+WordBlockMasks ScanWordBlockSse2(const char* block) {
+    const __m128i spaces = _mm_set1_epi8(' ');
+    const __m128i last_control = _mm_set1_epi8(' ' - 1);
+    WordBlockMasks masks;
+    for (size_t half = 0; half < 2; ++half) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + half * 16));
+        // Unsigned byte <= ' ' - 1 exactly when min(byte, ' ' - 1) is the byte itself
+        const __m128i is_control = _mm_cmpeq_epi8(_mm_min_epu8(bytes, last_control), bytes);
+        masks.spaces |= static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, spaces))) << (half * 16);
+        masks.controls |= static_cast<uint32_t>(_mm_movemask_epi8(is_control)) << (half * 16);
     }
-    vector<string_view> result;
-    str.remove_prefix(min(str.find_first_not_of(' '), str.size()));
+    return masks;
+}
+
+__attribute__((target("avx2"))) WordBlockMasks ScanWordBlockAvx2(const char* block) {
+    const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+    const __m256i last_control = _mm256_set1_epi8(' ' - 1);
+    const __m256i is_control = _mm256_cmpeq_epi8(_mm256_min_epu8(bytes, last_control), bytes);
+    return {static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')))),
+            static_cast<uint32_t>(_mm256_movemask_epi8(is_control))};
+}
+
+#endif
 
-    do {
-        int64_t space = str.find(' ', 0);
-        result.push_back(space == static_cast<int64_t>(str.npos) ? str.substr(0) : str.substr(0, space));
-        str.remove_prefix(min(str.find_first_not_of(' ', space), str.size()));
-    } while (!str.empty());
+}  // namespace
 
+WordBlockMasks ScanWordBlock(const char* block) {
+#if defined(__x86_64__)
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2 ? ScanWordBlockAvx2(block) : ScanWordBlockSse2(block);
+#else
+    WordBlockMasks masks;
+    for (size_t i = 0; i < WORD_BLOCK_SIZE; ++i) {
+        const auto byte = static_cast<unsigned char>(block[i]);
+        masks.spaces |= static_cast<uint32_t>(byte == ' ') << i;
+        masks.controls |= static_cast<uint32_t>(byte < ' ') << i;
+    }
+    return masks;
+#endif
+}
+
+vector<string_view> SplitIntoWords(string_view str) {
+    vector<string_view> result;
+    ForEachWord(str, [&result](const string_view word) {
+        result.push_back(word);
+    });
     return result;
 }
 
@@ -56,5 +99,9 @@ string JoinWithExclude(const set<string>& strings, const set<string>& exclude_wo
 }
 
 size_t CountWords(string_view str) {
-    return CountWords(std::execution::seq, str);
+    size_t count = 0;
+    ForEachWord(str, [&count](string_view) {
+        ++count;
+    });
+    return count;
 }
\ No newline at end of file
@@ -2,8 +2,10 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <execution>
 #include <functional>
+#include <iterator>
 #include <map>
 #include <memory>
 #include <numeric>
@@ -28,6 +30,71 @@ std::set<std::string, std::less<>> MakeUniqueNonEmptyStrings(const Container<T>&
     return MakeUniqueNonEmptyStrings(strings.begin(), strings.end());
 }
 
+/// Bytes of text classified by one ScanWordBlock call
+constexpr size_t WORD_BLOCK_SIZE = 32;
+
+/// Bit i of each mask tells whether byte i of a block is a space or a control character
+struct WordBlockMasks {
+    uint32_t spaces = 0;
+    uint32_t controls = 0;
+};
+
+/// Classifies WORD_BLOCK_SIZE bytes at block with AVX2 or SSE2 where available
+WordBlockMasks ScanWordBlock(const char* block);
+
+/// Calls visitor(word, is_valid) for every space-separated word of text in order, without allocating.
+/// A word is valid if it has no control characters, bytes in [0, ' '). Text is scanned once, a block at a time:
+/// words start and end where a space bit differs from the previous one, so a word costs two bit scans.
+template <typename Visitor>
+void ForEachCheckedWord(std::string_view text, Visitor visitor) {
+    size_t word_begin = 0;
+    bool is_in_word = false;
+    bool is_word_valid = true;
+    char tail[WORD_BLOCK_SIZE];
+    for (size_t offset = 0; offset < text.size(); offset += WORD_BLOCK_SIZE) {
+        const char* block = text.data() + offset;
+        if (text.size() - offset < WORD_BLOCK_SIZE) {
+            // Spaces after the text end its last word
+            std::fill(std::begin(tail), std::end(tail), ' ');
+            std::copy(block, text.data() + text.size(), tail);
+            block = tail;
+        }
+        const WordBlockMasks masks = ScanWordBlock(block);
+
+        // A control character is never a space, so every one belongs to the word around it
+        uint32_t controls = masks.controls;
+        const uint32_t letters = ~masks.spaces;
+        uint32_t transitions = letters ^ ((letters << 1) | static_cast<uint32_t>(is_in_word));
+        while (transitions != 0) {
+            const auto bit = static_cast<uint32_t>(__builtin_ctz(transitions));
+            if (is_in_word) {
+                const uint32_t word_bits = (1u << bit) - 1;
+                visitor(text.substr(word_begin, offset + bit - word_begin), is_word_valid && (controls & word_bits) == 0);
+                controls &= ~word_bits;
+            } else {
+                word_begin = offset + bit;
+                is_word_valid = true;
+            }
+            is_in_word = !is_in_word;
+            transitions &= transitions - 1;
+        }
+        if (is_in_word) {
+            is_word_valid = is_word_valid && controls == 0;
+        }
+    }
+    if (is_in_word) {
+        visitor(text.substr(word_begin), is_word_valid);
+    }
+}
+
+/// Calls visitor(word) for every space-separated word of text in order, without allocating
+template <typename Visitor>
+void ForEachWord(std::string_view text, Visitor visitor) {
+    ForEachCheckedWord(text, [&visitor](const std::string_view word, bool) {
+        visitor(word);
+    });
+}
+
 /// Splits a raw text string into list of space-separated words
 std::vector<std::string_view> SplitIntoWords(std::string_view text);
 
@@ -0,0 +1,115 @@
+#include "term_dictionary.h"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+TermDictionary TermDictionary::Load(const IndexFileReader& reader) {
+    TermDictionary result;
+    result.mapped_chars_ = reader.GetArray<char>(IndexSection::TERM_CHARS);
+    result.locations_ = reader.GetArray<TermLocation>(IndexSection::TERM_LOCATIONS);
+    result.hashes_ = reader.GetArray<size_t>(IndexSection::TERM_HASHES);
+    result.slots_ = reader.GetArray<TermId>(IndexSection::TERM_SLOTS);
+    const size_t slot_count = result.slots_.size();
+    if (result.hashes_.size() != result.locations_.size() || (slot_count & (slot_count - 1)) != 0 ||
+        (slot_count > 0 && result.locations_.size() * 2 > slot_count)) {
+        throw runtime_error("Term dictionary of the index file is inconsistent"s);
+    }
+    return result;
+}
+
+TermId TermDictionary::Find(string_view word) const {
+    if (slots_.empty()) {
+        return NO_TERM;
+    }
+    return slots_[FindSlot(word, hash<string_view>{}(word))];
+}
+
+TermId TermDictionary::Intern(string_view word) {
+    if ((locations_.size() + 1) * 2 > slots_.size()) {
+        Rehash(max(MIN_SLOT_COUNT, slots_.size() * 2));
+    }
+
+    const size_t word_hash = hash<string_view>{}(word);
+    const size_t slot = FindSlot(word, word_hash);
+    if (slots_[slot] != NO_TERM) {
+        return slots_[slot];
+    }
+    if (locations_.size() >= NO_TERM) {
+        throw overflow_error("Term dictionary is full"s);
+    }
+
+    if (blocks_.empty() || blocks_.back().capacity() - blocks_.back().size() < word.size()) {
+        blocks_.emplace_back().reserve(max(BLOCK_SIZE, word.size()));
+    }
+    auto& block = blocks_.back();
+    const TermLocation location{static_cast<uint32_t>(blocks_.size() - 1), static_cast<uint32_t>(block.size()),
+                                static_cast<uint32_t>(word.size())};
+    block.insert(block.end(), word.begin(), word.end());
+
+    const auto term = static_cast<TermId>(locations_.size());
+    locations_.Mutable().push_back(location);
+    hashes_.Mutable().push_back(word_hash);
+    slots_.Mutable()[slot] = term;
+    return term;
+}
+
+string_view TermDictionary::GetTerm(TermId term) const {
+    assert(term < locations_.size());
+    const TermLocation& location = locations_[term];
+    const char* chars = location.block == MAPPED_BLOCK ? mapped_chars_.data() : blocks_[location.block].data();
+    return {chars + location.offset, location.length};
+}
+
+size_t TermDictionary::GetHash(TermId term) const {
+    assert(term < hashes_.size());
+    return hashes_[term];
+}
+
+size_t TermDictionary::Size() const {
+    return locations_.size();
+}
+
+void TermDictionary::Save(IndexFileWriter& writer) const {
+    // Words of all blocks are stored as one mapped block
+    vector<char> chars;
+    vector<TermLocation> locations(locations_.size());
+    for (TermId term = 0; term < locations_.size(); ++term) {
+        const string_view word = GetTerm(term);
+        locations[term] = {MAPPED_BLOCK, static_cast<uint32_t>(chars.size()), static_cast<uint32_t>(word.size())};
+        chars.insert(chars.end(), word.begin(), word.end());
+    }
+    writer.AddSection(IndexSection::TERM_CHARS, move(chars));
+    writer.AddSection(IndexSection::TERM_LOCATIONS, move(locations));
+    writer.AddSection(IndexSection::TERM_HASHES, hashes_);
+    writer.AddSection(IndexSection::TERM_SLOTS, slots_);
+}
+
+size_t TermDictionary::FindSlot(string_view word, size_t hash) const {
+    const size_t mask = slots_.size() - 1;
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+        const TermId term = slots_[slot];
+        if (term == NO_TERM || (hashes_[term] == hash && GetTerm(term) == word)) {
+            return slot;
+        }
+    }
+}
+
+void TermDictionary::Rehash(size_t slot_count) {
+    auto& slots = slots_.Mutable();
+    slots.assign(slot_count, NO_TERM);
+    const size_t mask = slot_count - 1;
+    for (TermId term = 0; term < locations_.size(); ++term) {
+        size_t slot = hashes_[term] & mask;
+        while (slots[slot] != NO_TERM) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = term;
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+#include <vector>
+
+#include "index_file.h"
+#include "mapped_array.h"
+
+/// Dense number of an interned word
+using TermId = uint32_t;
+
+constexpr const TermId NO_TERM = std::numeric_limits<TermId>::max();
+
+/// Interns every word once into a pool of contiguous character blocks and assigns it a dense term id.
+/// Words are looked up by string_view through an open-addressing hash table in O(1).
+/// Views returned by GetTerm stay valid while the dictionary is alive: blocks are never reallocated.
+/// A loaded dictionary looks words up right in the mapped file and keeps newly interned words in its own blocks.
+class TermDictionary {
+   public:
+    /// Dictionary borrowing its arrays from a mapped index file
+    static TermDictionary Load(const IndexFileReader& reader);
+
+    /// Id of word, NO_TERM if the word was never interned
+    TermId Find(std::string_view word) const;
+
+    /// Id of word, interning it first if needed
+    TermId Intern(std::string_view word);
+
+    std::string_view GetTerm(TermId term) const;
+
+    /// Hash of the word of term, equal to std::hash<std::string_view> of it
+    size_t GetHash(TermId term) const;
+
+    size_t Size() const;
+
+    /// Adds the dictionary sections to writer; they refer to the dictionary until the file is written
+    void Save(IndexFileWriter& writer) const;
+
+   private:
+    struct TermLocation {
+        uint32_t block = 0;
+        uint32_t offset = 0;
+        uint32_t length = 0;
+    };
+
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+    static constexpr size_t MIN_SLOT_COUNT = 16;
+    /// Block of words located in mapped_chars_
+    static constexpr uint32_t MAPPED_BLOCK = std::numeric_limits<uint32_t>::max();
+
+    std::vector<std::vector<char>> blocks_;
+    MappedArray<char> mapped_chars_;
+    MappedArray<TermLocation> locations_;
+    MappedArray<size_t> hashes_;
+    /// Hash table of term ids, NO_TERM marks an empty slot. Never filled more than a half.
+    MappedArray<TermId> slots_;
+
+    size_t FindSlot(std::string_view word, size_t hash) const;
+
+    void Rehash(size_t slot_count);
+};
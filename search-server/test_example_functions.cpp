@@ -1,14 +1,39 @@
 #include "test_example_functions.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cassert>
+#include <cmath>
 #include <execution>
+#include <filesystem>
+#include <fstream>
+#include <future>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <optional>
 #include <random>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include "corpus_loader.h"
 #include "document.h"
+#include "durable_search_server.h"
+#include "index_file.h"
 #include "log_duration.h"
+#include "metrics.h"
+#include "posting_codec.h"
+#include "process_queries.h"
+#include "query_executor.h"
+#include "request_queue.h"
 #include "search_server.h"
+#include "sharded_search_server.h"
+#include "string_processing.h"
+#include "snapshot_search_server.h"
 #include "test_framework.h"
 
 using namespace std;
@@ -177,4 +202,1030 @@ void TestParFindTopDocuments() {
             ASSERT_EQUAL(ptr->id, *expected_ptr);
         }
     }
-}
\ No newline at end of file
+
+    cout << "Top 2:"s << endl;
+    // параллельная версия
+    {
+        auto docs = search_server.FindTopDocuments(execution::par, "curly nasty cat"s, DocumentStatus::ACTUAL, 2);
+        vector<int> expected_ids{2, 4};
+        ASSERT_EQUAL(expected_ids.size(), docs.size());
+        auto expected_ptr = expected_ids.begin();
+        for (auto ptr = docs.begin(); ptr != docs.end(); ++ptr, ++expected_ptr) {
+            PrintDocument(*ptr);
+            ASSERT_EQUAL(ptr->id, *expected_ptr);
+        }
+    }
+}
+
+void TestCompressIndex() {
+    // значения всех длин декодируются без потерь, включая хвост короче четвёрки
+    {
+        mt19937 generator;
+        vector<uint32_t> values(1'003);
+        for (size_t i = 0; i < values.size(); ++i) {
+            values[i] = static_cast<uint32_t>(generator() >> (8 * (i % 4)));
+        }
+        vector<uint32_t> ascending(values.size());
+        partial_sum(values.begin(), values.end(), ascending.begin(), [](uint32_t lhs, uint32_t rhs) {
+            return lhs + rhs % 1'000;
+        });
+        vector<uint8_t> encoded;
+        EncodeStreamVByte(values.data(), values.size(), encoded);
+        const size_t deltas_offset = encoded.size();
+        EncodeStreamVByteDeltas(ascending.data(), ascending.size(), 7, encoded);
+        encoded.resize(encoded.size() + STREAM_VBYTE_PADDING);
+
+        vector<uint32_t> decoded(values.size());
+        ASSERT(DecodeStreamVByte(encoded.data(), decoded.size(), decoded.data()) == encoded.data() + deltas_offset);
+        ASSERT(decoded == values);
+        DecodeStreamVByteDeltas(encoded.data() + deltas_offset, decoded.size(), 7, decoded.data());
+        ASSERT(decoded == ascending);
+    }
+
+    SearchServer search_server("and with"s);
+
+    int id = 0;
+    for (const string& text : {
+             "funny pet and nasty rat"s,
+             "funny pet with curly hair"s,
+             "funny pet and not very nasty rat"s,
+             "pet with rat and rat and rat"s,
+             "nasty rat with curly hair"s,
+         }) {
+        search_server.AddDocument(++id, text, DocumentStatus::ACTUAL, {1, 2});
+    }
+
+    const string query = "curly nasty rat -not"s;
+    const auto expected = search_server.FindTopDocuments(query);
+    const size_t uncompressed_size = search_server.GetIndexMemoryUsage();
+
+    search_server.CompressIndex();
+    ASSERT(search_server.GetIndexMemoryUsage() < uncompressed_size);
+    const auto docs = search_server.FindTopDocuments(execution::par, query);
+    ASSERT_EQUAL(expected.size(), docs.size());
+    for (size_t i = 0; i < docs.size(); ++i) {
+        ASSERT_EQUAL(docs[i].id, expected[i].id);
+        ASSERT(std::abs(docs[i].relevance - expected[i].relevance) < THRESHOLD);
+    }
+
+    // документы добавляются и удаляются и после сжатия
+    search_server.RemoveDocument(5);
+    search_server.AddDocument(6, "curly rat"s, DocumentStatus::ACTUAL, {5});
+    const auto updated_docs = search_server.FindTopDocuments(query);
+    ASSERT_EQUAL(updated_docs.size(), 4u);
+    ASSERT_EQUAL(updated_docs.front().id, 6);
+}
+
+void TestPrunedFindTopDocuments() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 300, 6);
+    const auto documents = GenerateQueries(generator, dictionary, 3'000, 40);
+
+    SearchServer search_server(dictionary[0]);
+    for (size_t i = 0; i < documents.size(); ++i) {
+        search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, {static_cast<int>(i % 4)});
+    }
+
+    // отсечение документов не меняет результат полного ранжирования
+    for (const string& query : GenerateQueries(generator, dictionary, 50, 20, 0.1)) {
+        const auto docs = search_server.FindTopDocuments(query);
+        auto expected = search_server.FindTopDocuments(query, DocumentStatus::ACTUAL, documents.size());
+        expected.resize(min(expected.size(), MAX_RESULT_DOCUMENT_COUNT));
+        ASSERT_EQUAL(docs.size(), expected.size());
+        for (size_t i = 0; i < docs.size(); ++i) {
+            ASSERT_EQUAL(docs[i].id, expected[i].id);
+            ASSERT_EQUAL(docs[i].relevance, expected[i].relevance);
+        }
+    }
+}
+
+void TestAddDocuments() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 300, 6);
+    const auto documents = GenerateQueries(generator, dictionary, 1'000, 30);
+
+    SearchServer expected_server(dictionary[0]);
+    vector<NewDocument> batch;
+    for (size_t i = 0; i < documents.size(); ++i) {
+        expected_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, {static_cast<int>(i % 4)});
+        batch.push_back({static_cast<int>(i), documents[i], DocumentStatus::ACTUAL, {static_cast<int>(i % 4)}});
+    }
+    SearchServer search_server(dictionary[0]);
+    search_server.AddDocuments(execution::par, batch);
+
+    ASSERT_EQUAL(search_server.GetDocumentCount(), expected_server.GetDocumentCount());
+    for (const int id : expected_server) {
+        ASSERT(search_server.GetWordFrequencies(id) == expected_server.GetWordFrequencies(id));
+    }
+    for (const string& query : GenerateQueries(generator, dictionary, 20, 10, 0.1)) {
+        const auto docs = search_server.FindTopDocuments(query);
+        const auto expected = expected_server.FindTopDocuments(query);
+        ASSERT_EQUAL(docs.size(), expected.size());
+        for (size_t i = 0; i < docs.size(); ++i) {
+            ASSERT_EQUAL(docs[i].id, expected[i].id);
+            ASSERT_EQUAL(docs[i].relevance, expected[i].relevance);
+        }
+    }
+
+    // документы до первого ошибочного добавляются, ошибка та же, что у AddDocument
+    SearchServer partial_server("and"s);
+    const vector<NewDocument> invalid_batch = {{1, "funny pet"sv, DocumentStatus::ACTUAL, {}},
+                                               {1, "nasty rat"sv, DocumentStatus::ACTUAL, {}},
+                                               {2, "curly hair"sv, DocumentStatus::ACTUAL, {}}};
+    ASSERT_THROWS(partial_server.AddDocuments(execution::par, invalid_batch), invalid_argument);
+    ASSERT_EQUAL(partial_server.GetDocumentCount(), 1);
+    ASSERT(partial_server.FindTopDocuments("rat"s).empty());
+}
+
+void TestSnapshotSearchServer() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 300, 6);
+    const auto documents = GenerateQueries(generator, dictionary, 2'000, 30);
+    const auto queries = GenerateQueries(generator, dictionary, 20, 10);
+
+    SnapshotSearchServer search_server(SearchServer{dictionary[0]});
+    search_server.AddDocument(0, documents[0]);
+    // изменения не видны до публикации
+    ASSERT_EQUAL(search_server.GetDocumentCount(), 0);
+    search_server.Publish();
+    ASSERT_EQUAL(search_server.GetDocumentCount(), 1);
+
+    atomic_bool is_writing = true;
+    auto reader = async(launch::async, [&] {
+        int last_count = 0;
+        size_t found_count = 0;
+        while (is_writing) {
+            const auto snapshot = search_server.GetSnapshot();
+            const int count = snapshot->GetDocumentCount();
+            ASSERT(count >= last_count);
+            last_count = count;
+            for (const string& query : queries) {
+                found_count += snapshot->FindTopDocuments(query).size();
+            }
+        }
+        return found_count;
+    });
+    int expected_count = documents.size();
+    for (size_t i = 1; i < documents.size(); ++i) {
+        search_server.AddDocument(i, documents[i]);
+        if (i % 100 == 0) {
+            search_server.RemoveDocument(i - 50);
+            --expected_count;
+            search_server.Publish();
+        }
+    }
+    search_server.Publish();
+    is_writing = false;
+    reader.get();
+
+    ASSERT_EQUAL(search_server.GetDocumentCount(), expected_count);
+    // обе копии сервера совпадают после публикации
+    search_server.Publish();
+    ASSERT_EQUAL(search_server.GetDocumentCount(), expected_count);
+}
+
+void TestShardedSearchServer() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 300, 6);
+    const auto documents = GenerateQueries(generator, dictionary, 2'000, 30);
+
+    SearchServer expected_server(dictionary[0]);
+    ShardedSearchServer search_server(dictionary[0], 4);
+    for (size_t i = 0; i < documents.size(); ++i) {
+        expected_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, {static_cast<int>(i % 4)});
+        search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, {static_cast<int>(i % 4)});
+    }
+    for (int id = 0; id < static_cast<int>(documents.size()); id += 7) {
+        expected_server.RemoveDocument(id);
+        search_server.RemoveDocument(id);
+    }
+    ASSERT_EQUAL(search_server.GetDocumentCount(), expected_server.GetDocumentCount());
+
+    // релевантность считается по статистике всех шардов и совпадает с несегментированным сервером с точностью до округления
+    for (const string& query : GenerateQueries(generator, dictionary, 20, 10, 0.1)) {
+        const auto docs = search_server.FindTopDocuments(query);
+        const auto expected = expected_server.FindTopDocuments(query);
+        ASSERT_EQUAL(docs.size(), expected.size());
+        for (size_t i = 0; i < docs.size(); ++i) {
+            ASSERT_EQUAL(docs[i].id, expected[i].id);
+            ASSERT(abs(docs[i].relevance - expected[i].relevance) < THRESHOLD);
+        }
+        ASSERT(search_server.MatchDocument(query, 1) == expected_server.MatchDocument(query, 1));
+    }
+
+    // некорректный запрос отклоняется, как и несегментированным сервером
+    ASSERT_THROWS(search_server.FindTopDocuments("cat --dog"s), invalid_argument);
+}
+
+void TestSaveLoadIndex() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 300, 6);
+    const auto documents = GenerateQueries(generator, dictionary, 2'000, 30);
+
+    SearchServer search_server(dictionary[0]);
+    for (size_t i = 0; i < documents.size(); ++i) {
+        search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, {static_cast<int>(i % 4)});
+        if (i == documents.size() / 2) {
+            search_server.CompressIndex();
+        }
+    }
+    for (int id = 0; id < static_cast<int>(documents.size()); id += 7) {
+        search_server.RemoveDocument(id);
+    }
+    search_server.AddDocument(5'000, documents[1], DocumentStatus::ACTUAL, {});
+
+    const string path = (filesystem::temp_directory_path() / "search_server_test.idx"s).string();
+    search_server.SaveIndex(path);
+    SearchServer loaded_server = SearchServer::LoadIndex(path);
+    ASSERT_EQUAL(loaded_server.GetDocumentCount(), search_server.GetDocumentCount());
+    ASSERT(equal(loaded_server.begin(), loaded_server.end(), search_server.begin(), search_server.end()));
+    ASSERT(loaded_server.GetStopWords() == search_server.GetStopWords());
+
+    // загруженный индекс отвечает на запросы так же, как исходный сервер
+    const auto queries = GenerateQueries(generator, dictionary, 20, 10, 0.1);
+    const auto check_queries = [&queries](const SearchServer& server, const SearchServer& expected_server) {
+        for (const string& query : queries) {
+            const auto docs = server.FindTopDocuments(execution::par, query);
+            const auto expected = expected_server.FindTopDocuments(query);
+            ASSERT_EQUAL(docs.size(), expected.size());
+            for (size_t i = 0; i < docs.size(); ++i) {
+                ASSERT_EQUAL(docs[i].id, expected[i].id);
+                ASSERT_EQUAL(docs[i].relevance, expected[i].relevance);
+            }
+            ASSERT(server.MatchDocument(query, 2) == expected_server.MatchDocument(query, 2));
+        }
+        ASSERT(server.GetWordFrequencies(2) == expected_server.GetWordFrequencies(2));
+    };
+    check_queries(loaded_server, search_server);
+
+    // изменения загруженного сервера не затрагивают файл
+    const int saved_count = search_server.GetDocumentCount();
+    for (SearchServer* server : {&search_server, &loaded_server}) {
+        server->RemoveDocument(1);
+        server->AddDocument(6'000, documents[2], DocumentStatus::ACTUAL, {});
+        ostringstream report;
+        auto* const cout_buffer = cout.rdbuf(report.rdbuf());
+        server->RemoveDuplicates();
+        cout.rdbuf(cout_buffer);
+        ASSERT_EQUAL(report.str(), "Found duplicate document 6000\n"s);
+    }
+    ASSERT_EQUAL(loaded_server.GetDocumentCount(), search_server.GetDocumentCount());
+    check_queries(loaded_server, search_server);
+    ASSERT_EQUAL(SearchServer::LoadIndex(path).GetDocumentCount(), saved_count);
+
+    // повреждённый файл не загружается
+    {
+        fstream file(path, ios::in | ios::out | ios::binary);
+        file.seekp(-8, ios::end);
+        file.put('?');
+    }
+    try {
+        SearchServer::LoadIndex(path);
+        ASSERT_HINT(false, "corrupted index file is loaded"s);
+    } catch (const runtime_error&) {
+    }
+    filesystem::remove(path);
+
+    // ошибки записи и синхронизации каталога не замалчиваются
+    const auto missing_directory = filesystem::temp_directory_path() / "search_server_no_such_directory"s;
+    ASSERT_THROWS(search_server.SaveIndex((missing_directory / "index"s).string()), runtime_error);
+    ASSERT_THROWS(SyncDirectory(missing_directory.string()), runtime_error);
+}
+
+void TestDurableSearchServer() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 300, 6);
+    const auto documents = GenerateQueries(generator, dictionary, 2'000, 30);
+    const auto queries = GenerateQueries(generator, dictionary, 20, 10, 0.1);
+
+    const auto directory = filesystem::temp_directory_path() / "search_server_test_wal"s;
+    filesystem::remove_all(directory);
+
+    vector<vector<Document>> expected;
+    {
+        DurableSearchServer search_server(directory.string(), SearchServer(dictionary[0]));
+        // потоки добавляют документы одновременно и делят fsync
+        vector<thread> threads;
+        for (int thread_index = 0; thread_index < 4; ++thread_index) {
+            threads.emplace_back([&, thread_index]() {
+                for (size_t i = thread_index; i < documents.size(); i += 4) {
+                    search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, {static_cast<int>(i % 4)});
+                    if (i == documents.size() / 2) {
+                        search_server.Compact();
+                    }
+                }
+            });
+        }
+        for (thread& worker : threads) {
+            worker.join();
+        }
+        for (int id = 0; id < static_cast<int>(documents.size()); id += 7) {
+            search_server.RemoveDocument(id);
+        }
+        search_server.AddDocuments({{5'000, documents[1], DocumentStatus::ACTUAL, {1}}, {5'001, "funny pet"sv, DocumentStatus::BANNED, {}}});
+        for (const string& query : queries) {
+            expected.push_back(search_server.FindTopDocuments(query));
+        }
+    }
+
+    const auto check_restored = [&]() {
+        DurableSearchServer search_server(directory.string(), SearchServer());
+        ASSERT_EQUAL(search_server.GetDocumentCount(), static_cast<int>(documents.size() - (documents.size() + 6) / 7 + 2));
+        for (size_t i = 0; i < queries.size(); ++i) {
+            const auto docs = search_server.FindTopDocuments(queries[i]);
+            ASSERT_EQUAL(docs.size(), expected[i].size());
+            for (size_t j = 0; j < docs.size(); ++j) {
+                ASSERT_EQUAL(docs[j].id, expected[i][j].id);
+                ASSERT_EQUAL(docs[j].relevance, expected[i][j].relevance);
+            }
+        }
+    };
+    // состояние восстанавливается из снимка и журнала
+    check_restored();
+
+    // оборванная запись в конце журнала отбрасывается
+    for (const auto& entry : filesystem::directory_iterator(directory)) {
+        if (entry.path().filename().string().rfind("log."s, 0) == 0) {
+            ofstream(entry.path(), ios::binary | ios::app) << "torn"s;
+        }
+    }
+    check_restored();
+
+    // после сжатия журнала остаётся один снимок
+    {
+        DurableSearchServer search_server(directory.string(), SearchServer());
+        search_server.Compact();
+    }
+    check_restored();
+    ASSERT_EQUAL(distance(filesystem::directory_iterator(directory), filesystem::directory_iterator{}), 2);
+    filesystem::remove_all(directory);
+}
+
+void TestQueryExecutor() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 300, 6);
+    const auto documents = GenerateQueries(generator, dictionary, 2'000, 30);
+    SearchServer search_server(dictionary[0]);
+    for (size_t i = 0; i < documents.size(); ++i) {
+        search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, {static_cast<int>(i % 4)});
+    }
+
+    // большой пакет выполняет запросы последовательно, маленький - параллельно, результаты те же
+    QueryExecutor executor(4);
+    for (const size_t query_count : {100, 2}) {
+        const auto queries = GenerateQueries(generator, dictionary, query_count, 10, 0.1);
+        const auto expected = ProcessQueriesJoined(execution::seq, search_server, queries);
+        const auto joined = ProcessQueriesJoined(executor, search_server, queries);
+        ASSERT_EQUAL(joined.size(), expected.size());
+        ASSERT(equal(joined.begin(), joined.end(), expected.begin(), [](const Document& lhs, const Document& rhs) {
+            return lhs.id == rhs.id && lhs.relevance == rhs.relevance;
+        }));
+    }
+
+    // диапазоны запроса из маленького пакета выполняются только рабочими потоками пула
+    {
+        SearchServer large_server(dictionary[0]);
+        for (int i = 0; i < 10'000; ++i) {
+            large_server.AddDocument(i, documents[i % documents.size()], DocumentStatus::ACTUAL, {i % 7});
+        }
+        const auto queries = GenerateQueries(generator, dictionary, 2, 10, 0.1);
+        atomic_int outside_call_count = 0;
+        const auto predicate = [&executor, &outside_call_count](int, DocumentStatus, int) {
+            if (!executor.IsWorkerThread()) {
+                ++outside_call_count;
+            }
+            return true;
+        };
+        vector<vector<Document>> found(queries.size());
+        executor.ParallelFor(queries.size(), [&](size_t i) {
+            found[i] = large_server.FindTopDocuments(ExecutorPolicy{executor}, queries[i], predicate);
+        });
+        ASSERT_EQUAL(outside_call_count, 0);
+        for (size_t i = 0; i < queries.size(); ++i) {
+            const auto expected = large_server.FindTopDocuments(queries[i], predicate);
+            ASSERT_EQUAL(found[i].size(), expected.size());
+            ASSERT(equal(found[i].begin(), found[i].end(), expected.begin(), [](const Document& lhs, const Document& rhs) {
+                return lhs.id == rhs.id && lhs.relevance == rhs.relevance;
+            }));
+        }
+    }
+
+    // вложенные вызовы выполняются теми же потоками
+    atomic_int sum = 0;
+    executor.ParallelFor(10, [&executor, &sum](size_t i) {
+        executor.ParallelFor(10, [&sum, i](size_t j) {
+            sum += static_cast<int>(i * 10 + j);
+        });
+    });
+    ASSERT_EQUAL(sum, 4950);
+
+    bool is_thrown = false;
+    try {
+        executor.ParallelFor(10, [](size_t i) {
+            if (i == 5) {
+                throw out_of_range("test"s);
+            }
+        });
+    } catch (const out_of_range&) {
+        is_thrown = true;
+    }
+    ASSERT(is_thrown);
+}
+
+void TestQueryCache() {
+    SearchServer search_server("and in"s);
+    search_server.AddDocument(1, "white cat with a collar"sv, DocumentStatus::ACTUAL, {8, -3});
+    search_server.AddDocument(2, "fluffy cat fluffy tail"sv, DocumentStatus::ACTUAL, {7, 2, 7});
+    search_server.AddDocument(3, "well groomed dog"sv, DocumentStatus::BANNED, {5, -12, 2, 1});
+    search_server.SetQueryCacheCapacity(2);
+
+    // одинаковые после разбора запросы попадают в одну запись
+    const auto expected = search_server.FindTopDocuments("fluffy cat -dog"sv);
+    ASSERT_EQUAL(search_server.FindTopDocuments("-dog cat and fluffy cat"sv).size(), expected.size());
+    ASSERT_EQUAL(search_server.FindTopDocuments(execution::par, "cat fluffy -dog"sv)[0].id, expected[0].id);
+    auto statistics = search_server.GetQueryCacheStatistics();
+    ASSERT_EQUAL(statistics.hits, 2u);
+    ASSERT_EQUAL(statistics.misses, 1u);
+
+    // статус и запросы с предикатом кэшируются отдельно
+    ASSERT_EQUAL(search_server.FindTopDocuments("dog"sv, DocumentStatus::BANNED).size(), 1u);
+    ASSERT_EQUAL(search_server.FindTopDocuments("dog"sv).size(), 0u);
+    search_server.FindTopDocuments("cat"sv, [](int, DocumentStatus, int) {
+        return true;
+    });
+    statistics = search_server.GetQueryCacheStatistics();
+    ASSERT_EQUAL(statistics.misses, 3u);
+    ASSERT_EQUAL(statistics.evictions, 1u);
+
+    // изменение индекса делает записи недействительными
+    const uint64_t generation = search_server.GetGeneration();
+    search_server.AddDocument(4, "dog with a collar"sv, DocumentStatus::ACTUAL, {1});
+    ASSERT(search_server.GetGeneration() > generation);
+    ASSERT_EQUAL(search_server.FindTopDocuments("dog"sv).size(), 1u);
+    search_server.RemoveDocument(4);
+    ASSERT_EQUAL(search_server.FindTopDocuments("dog"sv).size(), 0u);
+    statistics = search_server.GetQueryCacheStatistics();
+    ASSERT_EQUAL(statistics.invalidations, 2u);
+    ASSERT_EQUAL(statistics.hits, 2u);
+}
+
+void TestPreparedQuery() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 300, 6);
+    const auto documents = GenerateQueries(generator, dictionary, 1'000, 30);
+    SearchServer search_server(dictionary[0]);
+    for (size_t i = 0; i < documents.size(); ++i) {
+        search_server.AddDocument(i, documents[i], static_cast<DocumentStatus>(i % 2), {static_cast<int>(i % 4)});
+    }
+
+    for (const string& raw_query : GenerateQueries(generator, dictionary, 20, 10, 0.1)) {
+        const auto query = search_server.PrepareQuery(raw_query);
+        for (const DocumentStatus status : {DocumentStatus::ACTUAL, DocumentStatus::IRRELEVANT}) {
+            const auto docs = search_server.FindTopDocuments(execution::par, query, status);
+            const auto expected = search_server.FindTopDocuments(raw_query, status);
+            ASSERT_EQUAL(docs.size(), expected.size());
+            for (size_t i = 0; i < docs.size(); ++i) {
+                ASSERT_EQUAL(docs[i].id, expected[i].id);
+                ASSERT_EQUAL(docs[i].relevance, expected[i].relevance);
+            }
+        }
+        for (int id = 0; id < 50; ++id) {
+            ASSERT(search_server.MatchDocument(query, id) == search_server.MatchDocument(raw_query, id));
+        }
+    }
+
+    // слова, которых не было в словаре при подготовке, находятся после их добавления
+    const auto query = search_server.PrepareQuery("zebra -giraffe"sv);
+    ASSERT(search_server.FindTopDocuments(query).empty());
+    search_server.AddDocument(1'000, "zebra"sv);
+    search_server.AddDocument(1'001, "zebra giraffe"sv);
+    const auto docs = search_server.FindTopDocuments(query, [](int, DocumentStatus, int) {
+        return true;
+    });
+    ASSERT_EQUAL(docs.size(), 1u);
+    ASSERT_EQUAL(docs[0].id, 1'000);
+    ASSERT(get<0>(search_server.MatchDocument(query, 1'001)).empty());
+    ASSERT_THROWS(search_server.PrepareQuery("cat --dog"sv), invalid_argument);
+}
+
+void TestForEachCheckedWord() {
+    // слова и номер первого слова с управляющим символом, words.size(), если такого нет
+    const auto check_words = [](const string_view text) {
+        vector<string_view> words;
+        size_t invalid_word_index = numeric_limits<size_t>::max();
+        ForEachCheckedWord(text, [&words, &invalid_word_index](const string_view word, bool is_valid) {
+            if (!is_valid && invalid_word_index == numeric_limits<size_t>::max()) {
+                invalid_word_index = words.size();
+            }
+            words.push_back(word);
+        });
+        return pair{words, min(invalid_word_index, words.size())};
+    };
+
+    // слова пересекают границы 32-байтных блоков, текст кончается на границе блока
+    const string text = "  white cat"s + string(21, ' ') + "with_a_collar_and_a_very_long_tail_"s + string(28, ' ') + "x"s;
+    const auto [words, invalid_word_index] = check_words(text);
+    ASSERT(words == SplitIntoWords(text));
+    ASSERT_EQUAL(words.size(), 4u);
+    ASSERT_EQUAL(words[2], "with_a_collar_and_a_very_long_tail_"sv);
+    ASSERT_EQUAL(words[3], "x"sv);
+    ASSERT_EQUAL(invalid_word_index, words.size());
+
+    ASSERT(check_words("   "sv).first.empty());
+    ASSERT_EQUAL(check_words("cat d\x12og fl\x01uffy"sv).second, 1u);
+    ASSERT_EQUAL(check_words("\xD0\xBA\xD0\xBE\xD1\x82 dog"sv).second, 2u);
+    ASSERT_THROWS(SearchServer().AddDocument(1, "white cat with a co\tllar"sv), invalid_argument);
+
+    // обход слов без построения вектора отмечает каждое некорректное слово
+    ASSERT_EQUAL(CountWords(text), 4u);
+    vector<bool> validity;
+    ForEachCheckedWord("a\x01 b "s + string(40, 'c') + "\x02 d"s, [&validity](string_view, bool is_valid) {
+        validity.push_back(is_valid);
+    });
+    ASSERT(validity == vector<bool>({false, true, false, true}));
+}
+
+void TestLoadCorpus() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 300, 6);
+    const auto documents = GenerateQueries(generator, dictionary, 2'000, 30);
+    const string path = (filesystem::temp_directory_path() / "search_server_corpus.tsv"s).string();
+    const vector<string_view> statuses = {"ACTUAL"sv, "IRRELEVANT"sv, "BANNED"sv, "REMOVED"sv};
+
+    SearchServer expected_server(dictionary[0]);
+    {
+        ofstream out(path);
+        for (size_t i = 0; i < documents.size(); ++i) {
+            const vector<int> ratings = {static_cast<int>(i % 7), -3};
+            expected_server.AddDocument(i, documents[i], static_cast<DocumentStatus>(i % 4), ratings);
+            out << i << '\t' << statuses[i % 4] << '\t' << ratings[0] << ' ' << ratings[1] << '\t' << documents[i] << (i % 2 ? "\r\n"s : "\n"s);
+        }
+    }
+
+    // пакеты меньше корпуса проходят через очередь между потоками
+    SearchServer search_server(dictionary[0]);
+    ASSERT_EQUAL(LoadCorpus(path, search_server, 300), documents.size());
+    ASSERT_EQUAL(search_server.GetDocumentCount(), expected_server.GetDocumentCount());
+    for (const string& query : GenerateQueries(generator, dictionary, 20, 10, 0.1)) {
+        for (const DocumentStatus status : {DocumentStatus::ACTUAL, DocumentStatus::BANNED}) {
+            const auto docs = search_server.FindTopDocuments(query, status);
+            const auto expected = expected_server.FindTopDocuments(query, status);
+            ASSERT_EQUAL(docs.size(), expected.size());
+            for (size_t i = 0; i < docs.size(); ++i) {
+                ASSERT_EQUAL(docs[i].id, expected[i].id);
+                ASSERT_EQUAL(docs[i].rating, expected[i].rating);
+            }
+        }
+    }
+
+    // документы до некорректной строки добавляются
+    {
+        ofstream out(path);
+        out << "1\tACTUAL\t5\tcurly cat\n\n2\tACTUAL\t\tcurly dog\n3\tUNKNOWN\t1\tcurly rat\n4\tACTUAL\t1\tcurly bird\n"s;
+    }
+    SearchServer partial_server;
+    ASSERT_THROWS(LoadCorpus(path, partial_server), invalid_argument);
+    ASSERT_EQUAL(partial_server.GetDocumentCount(), 2);
+    ASSERT_THROWS(LoadCorpus(path, partial_server), invalid_argument);
+    ASSERT_EQUAL(partial_server.GetDocumentCount(), 2);
+    filesystem::remove(path);
+}
+
+void TestPurgeRemovedDocuments() {
+    mt19937 generator;
+    const auto dictionary = GenerateDictionary(generator, 300, 6);
+    const auto documents = GenerateQueries(generator, dictionary, 2'000, 30);
+    const int document_count = static_cast<int>(documents.size());
+
+    SearchServer search_server(dictionary[0]);
+    for (int id = 0; id < document_count; ++id) {
+        search_server.AddDocument(id, documents[id], DocumentStatus::ACTUAL, {id % 5});
+        if (id == document_count / 2) {
+            search_server.CompressIndex();
+        }
+    }
+    // частоты слов строятся один раз и отдаются по ссылке
+    const auto* frequencies = &search_server.GetWordFrequencies(3);
+    ASSERT_EQUAL(&search_server.GetWordFrequencies(3), frequencies);
+    for (int id = 0; id < document_count; id += 3) {
+        if (id % 2 == 0) {
+            search_server.RemoveDocument(id);
+        } else {
+            search_server.RemoveDocument(execution::par, id);
+        }
+    }
+    // удалённый id можно добавить снова до очистки
+    search_server.AddDocument(3, documents[7], DocumentStatus::ACTUAL, {});
+    ASSERT_EQUAL(search_server.GetPendingRemovalCount(), static_cast<size_t>((document_count + 2) / 3));
+    {
+        SearchServer single_server(dictionary[0]);
+        single_server.AddDocument(3, documents[7], DocumentStatus::ACTUAL, {});
+        ASSERT(search_server.GetWordFrequencies(3) == single_server.GetWordFrequencies(3));
+    }
+
+    SearchServer expected_server(dictionary[0]);
+    vector<int> expected_ids;
+    for (int id = 0; id < document_count; ++id) {
+        if (id % 3 != 0) {
+            expected_server.AddDocument(id, documents[id], DocumentStatus::ACTUAL, {id % 5});
+            expected_ids.push_back(id);
+        }
+    }
+    expected_server.AddDocument(3, documents[7], DocumentStatus::ACTUAL, {});
+    expected_ids.push_back(3);
+
+    // удалённые документы не находятся, а частоты слов считаются только по оставшимся
+    const auto queries = GenerateQueries(generator, dictionary, 30, 10, 0.1);
+    const auto check_server = [&](const SearchServer& server) {
+        ASSERT_EQUAL(server.GetDocumentCount(), expected_server.GetDocumentCount());
+        ASSERT(vector<int>(server.begin(), server.end()) == expected_ids);
+        ASSERT_THROWS(server.MatchDocument(dictionary[1], 6), out_of_range);
+        ASSERT(server.GetWordFrequencies(6).empty());
+        for (const string& query : queries) {
+            auto docs = server.FindTopDocuments(query, DocumentStatus::ACTUAL, documents.size());
+            auto expected = expected_server.FindTopDocuments(query, DocumentStatus::ACTUAL, documents.size());
+            ASSERT_EQUAL(docs.size(), expected.size());
+            const auto by_id = [](const Document& lhs, const Document& rhs) {
+                return lhs.id < rhs.id;
+            };
+            sort(docs.begin(), docs.end(), by_id);
+            sort(expected.begin(), expected.end(), by_id);
+            for (size_t i = 0; i < docs.size(); ++i) {
+                ASSERT_EQUAL(docs[i].id, expected[i].id);
+                ASSERT(abs(docs[i].relevance - expected[i].relevance) < 1e-12);
+            }
+        }
+    };
+    check_server(search_server);
+
+    // очистка не меняет результатов, поэтому не меняет и поколение
+    const auto top_documents = search_server.FindTopDocuments(queries[0]);
+    const uint64_t generation = search_server.GetGeneration();
+    search_server.PurgeRemovedDocuments();
+    ASSERT_EQUAL(search_server.GetPendingRemovalCount(), 0u);
+    ASSERT_EQUAL(search_server.GetGeneration(), generation);
+    const auto purged_documents = search_server.FindTopDocuments(queries[0]);
+    ASSERT_EQUAL(purged_documents.size(), top_documents.size());
+    for (size_t i = 0; i < purged_documents.size(); ++i) {
+        ASSERT_EQUAL(purged_documents[i].id, top_documents[i].id);
+        ASSERT_EQUAL(purged_documents[i].relevance, top_documents[i].relevance);
+    }
+    check_server(search_server);
+
+    // очистка уплотняет порядковые номера: новые документы, дубликаты и похожие документы находятся как прежде
+    search_server.AddDocument(document_count, documents[1], DocumentStatus::ACTUAL, {});
+    expected_server.AddDocument(document_count, documents[1], DocumentStatus::ACTUAL, {});
+    expected_ids.push_back(document_count);
+    ASSERT(search_server.FindDuplicate(document_count) == optional<int>(1));
+    ASSERT(search_server.FindNearDuplicates(0.9) == expected_server.FindNearDuplicates(0.9));
+    check_server(search_server);
+
+    // файл индекса сохраняется без ожидающих удалений
+    search_server.RemoveDocument(4);
+    expected_server.RemoveDocument(4);
+    expected_ids.erase(find(expected_ids.begin(), expected_ids.end(), 4));
+    const string path = (filesystem::temp_directory_path() / "search_server_purge.idx"s).string();
+    search_server.SaveIndex(path);
+    ASSERT_EQUAL(search_server.GetPendingRemovalCount(), 1u);
+    const SearchServer loaded_server = SearchServer::LoadIndex(path);
+    ASSERT_EQUAL(loaded_server.GetPendingRemovalCount(), 0u);
+    check_server(loaded_server);
+    filesystem::remove(path);
+}
+
+void TestDuplicateDocuments() {
+    SearchServer search_server("and with"s);
+    search_server.AddDocument(1, "funny pet and nasty rat"sv);
+    search_server.AddDocument(2, "funny pet with curly hair"sv);
+    // те же слова в другом порядке и с повторами
+    search_server.AddDocument(4, "rat nasty pet funny rat"sv);
+    search_server.AddDocument(3, "nasty rat and funny pet with nasty"sv);
+    search_server.AddDocument(5, "funny pet and rat"sv);
+    search_server.AddDocument(6, "curly hair pet funny"sv);
+
+    ASSERT(search_server.FindDuplicate(4) == optional<int>(1));
+    ASSERT(search_server.FindDuplicate(1) == optional<int>(3));
+    ASSERT(search_server.FindDuplicate(6) == optional<int>(2));
+    ASSERT(!search_server.FindDuplicate(5).has_value());
+    ASSERT(!search_server.FindDuplicate(7).has_value());
+
+    // загруженный сервер находит дубликаты до первого изменения и после него
+    const string path = (filesystem::temp_directory_path() / "search_server_duplicates.idx"s).string();
+    search_server.SaveIndex(path);
+    SearchServer loaded_server = SearchServer::LoadIndex(path);
+    filesystem::remove(path);
+    ASSERT(loaded_server.FindDuplicate(4) == optional<int>(1));
+    loaded_server.RemoveDocument(1);
+    ASSERT(loaded_server.FindDuplicate(4) == optional<int>(3));
+
+    // пакетное удаление пропускает отсутствующие документы
+    loaded_server.RemoveDocuments(execution::par, {3, 8, 4});
+    ASSERT_EQUAL(loaded_server.GetDocumentCount(), 3);
+    ASSERT(!loaded_server.FindDuplicate(5).has_value());
+
+    // удалённые дубликаты выводятся одним списком по возрастанию id
+    ostringstream report;
+    auto* const cout_buffer = cout.rdbuf(report.rdbuf());
+    search_server.RemoveDuplicates(execution::par);
+    cout.rdbuf(cout_buffer);
+    ASSERT_EQUAL(report.str(), "Found duplicate document 3\nFound duplicate document 4\nFound duplicate document 6\n"s);
+    ASSERT(vector<int>(search_server.begin(), search_server.end()) == vector<int>({1, 2, 5}));
+
+    // при запрете дубликатов документ не добавляется, а пакет добавляется до первого дубликата
+    search_server.SetDuplicatePolicy(DuplicatePolicy::REJECT);
+    ASSERT_THROWS(search_server.AddDocument(7, "pet rat funny nasty"sv), invalid_argument);
+    ASSERT_EQUAL(search_server.GetDocumentCount(), 3);
+    const vector<NewDocument> documents = {{8, "white cat"sv, DocumentStatus::ACTUAL, {}},
+                                           {9, "black dog"sv, DocumentStatus::ACTUAL, {}},
+                                           {10, "cat white and white"sv, DocumentStatus::ACTUAL, {}},
+                                           {11, "brown bird"sv, DocumentStatus::ACTUAL, {}}};
+    ASSERT_THROWS(search_server.AddDocuments(execution::par, documents), invalid_argument);
+    ASSERT(vector<int>(search_server.begin(), search_server.end()) == vector<int>({1, 2, 5, 8, 9}));
+    ASSERT(search_server.FindTopDocuments("bird"sv).empty());
+}
+
+void TestNearDuplicateDocuments() {
+    // текст из слов prefix0 ... prefix(count-1) и дополнительных слов
+    const auto make_text = [](const string& prefix, int count, const string& extra_words) {
+        string text;
+        for (int i = 0; i < count; ++i) {
+            text += prefix + to_string(i) + ' ';
+        }
+        return text + extra_words;
+    };
+    const vector<string> texts = {make_text("w"s, 20, ""s),       make_text("w"s, 19, "x1"s), make_text("w"s, 18, "x1 x2"s),
+                                  make_text("y"s, 20, ""s),       make_text("y"s, 10, "z1 z2 z3 z4 z5 z6 z7 z8 z9 z10"s),
+                                  make_text("y"s, 20, "y0 y1"s)};
+    SearchServer search_server(""s);
+    for (int id = 1; id <= static_cast<int>(texts.size()); ++id) {
+        search_server.AddDocument(id, texts[id - 1]);
+    }
+
+    // сходство соседних документов 19/21, первого и третьего 18/22: цепочка объединяет все три
+    ASSERT(search_server.FindNearDuplicates(0.85) == vector<vector<int>>({{1, 2, 3}, {4, 6}}));
+    ASSERT(search_server.FindNearDuplicates(execution::par, 0.8) == vector<vector<int>>({{1, 2, 3}, {4, 6}}));
+    ASSERT(search_server.FindNearDuplicates(1.0) == vector<vector<int>>({{4, 6}}));
+    ASSERT_THROWS(search_server.FindNearDuplicates(0.0), invalid_argument);
+    ASSERT_THROWS(search_server.FindNearDuplicates(1.5), invalid_argument);
+
+    // подписи сохраняются в файле индекса
+    const string path = (filesystem::temp_directory_path() / "search_server_near_duplicates.idx"s).string();
+    search_server.SaveIndex(path);
+    const SearchServer loaded_server = SearchServer::LoadIndex(path);
+    filesystem::remove(path);
+    ASSERT(loaded_server.FindNearDuplicates(0.85) == vector<vector<int>>({{1, 2, 3}, {4, 6}}));
+
+    // от каждого кластера остаётся документ с наименьшим id
+    ostringstream report;
+    auto* const cout_buffer = cout.rdbuf(report.rdbuf());
+    search_server.RemoveNearDuplicates(execution::par, 0.85);
+    cout.rdbuf(cout_buffer);
+    ASSERT_EQUAL(report.str(), "Found duplicate document 2\nFound duplicate document 3\nFound duplicate document 6\n"s);
+    ASSERT(vector<int>(search_server.begin(), search_server.end()) == vector<int>({1, 4, 5}));
+    ASSERT(search_server.FindNearDuplicates(0.85).empty());
+
+    // документ, добавленный после удаления, снова находится
+    search_server.AddDocument(7, make_text("w"s, 20, "x3"s));
+    ASSERT(search_server.FindNearDuplicates(0.85) == vector<vector<int>>({{1, 7}}));
+
+    // все три документа делят ключи полос: крайние похожи лишь на 14/18, но через средний (15/17 и 14/16) попадают
+    // в один кластер, поэтому документы с общим ключом сравниваются попарно, а не только с первым
+    SearchServer chain_server(""s);
+    chain_server.AddDocument(1, "w20 w24 w25 w26 w27 w28 w3 w35 w36 w4 w41 w46 w51 w56 w58 w6 w9"sv);
+    chain_server.AddDocument(2, "w20 w24 w25 w26 w27 w28 w35 w36 w4 w41 w46 w51 w58 w6 w9"sv);
+    chain_server.AddDocument(3, "w20 w25 w26 w27 w28 w33 w35 w36 w4 w41 w46 w51 w58 w6 w9"sv);
+    ASSERT(chain_server.FindNearDuplicates(0.8) == vector<vector<int>>({{1, 2, 3}}));
+}
+
+void TestBatchMatchDocuments() {
+    // пакетный матчинг совпадает с MatchDocument для каждого документа
+    mt19937 generator(42);
+    const vector<string> dictionary = GenerateDictionary(generator, 200, 6);
+    SearchServer search_server("and with"s);
+    const int document_count = 3 * static_cast<int>(MATCH_RANGE_SIZE);
+    for (int id = 0; id < document_count; ++id) {
+        search_server.AddDocument(id, GenerateQuery(generator, dictionary, 10, 0.0), static_cast<DocumentStatus>(id % 4), {id});
+        if (id == document_count / 2) {
+            search_server.CompressIndex();
+        }
+    }
+    for (int id = 0; id < document_count; id += 7) {
+        search_server.RemoveDocument(id);
+    }
+
+    const auto check = [&search_server](const string& raw_query) {
+        const auto query = search_server.PrepareQuery(raw_query);
+        vector<DocumentMatch> matches;
+        search_server.MatchDocuments(execution::par, query, [&matches](const DocumentMatch& match) {
+            matches.push_back(match);
+        });
+        ASSERT_EQUAL(matches.size(), static_cast<size_t>(search_server.GetDocumentCount()));
+        auto match = matches.begin();
+        for (const int document_id : search_server) {
+            const auto [words, status] = search_server.MatchDocument(raw_query, document_id);
+            ASSERT_EQUAL(match->id, document_id);
+            ASSERT(match->words == words);
+            ASSERT(match->status == status);
+            ++match;
+        }
+
+        // документы по списку id выдаются в порядке добавления, каждый один раз
+        vector<int> ids;
+        search_server.MatchDocuments(query, vector<int>{5, 3, 5, 9}, [&ids](const DocumentMatch& match) {
+            ids.push_back(match.id);
+        });
+        ASSERT(ids == vector<int>({3, 5, 9}));
+    };
+    check(dictionary[0] + ' ' + dictionary[1] + ' ' + dictionary[2]);
+    check(dictionary[3] + ' ' + dictionary[4] + " -"s + dictionary[5]);
+    check("unknown"s);
+
+    const auto query = search_server.PrepareQuery(dictionary[0]);
+    ASSERT_THROWS(search_server.MatchDocuments(query, vector<int>{1, 7}, [](const DocumentMatch&) {}), out_of_range);
+}
+
+void TestRequestQueue() {
+    SearchServer search_server("and in at"s);
+    search_server.AddDocument(1, "curly cat curly tail"sv, DocumentStatus::ACTUAL, {7, 2, 7});
+    search_server.AddDocument(2, "curly dog and fancy collar"sv, DocumentStatus::ACTUAL, {1, 2, 3});
+    search_server.AddDocument(3, "big cat fancy collar "sv, DocumentStatus::ACTUAL, {1, 2, 8});
+    search_server.AddDocument(4, "big dog sparrow Eugene"sv, DocumentStatus::ACTUAL, {1, 3, 2});
+    search_server.AddDocument(5, "big dog sparrow Vasiliy"sv, DocumentStatus::ACTUAL, {1, 1, 1});
+
+    // окно суток: самые старые запросы без результатов вытесняются
+    {
+        RequestQueue request_queue(search_server);
+        for (int i = 0; i < 1439; ++i) {
+            request_queue.AddFindRequest("empty request"s);
+        }
+        request_queue.AddFindRequest("curly dog"s);
+        request_queue.AddFindRequest("big collar"s);
+        request_queue.AddFindRequest("sparrow"s);
+        ASSERT_EQUAL(request_queue.GetNoResultRequests(), 1437);
+        ASSERT_EQUAL(request_queue.GetRequestCount(), 1440u);
+        ASSERT(request_queue.GetQueries().empty());
+    }
+
+    // запросы из нескольких потоков учитываются без потерь
+    {
+        RequestQueue request_queue(search_server, 100);
+        vector<thread> threads;
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([&request_queue]() {
+                for (int j = 0; j < 1000; ++j) {
+                    request_queue.AddFindRequest(j % 2 == 0 ? "empty request"s : "curly dog"s);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        ASSERT_EQUAL(request_queue.GetRequestCount(), 100u);
+        ASSERT(request_queue.GetNoResultRequests() <= 100);
+        for (int i = 0; i < 100; ++i) {
+            request_queue.AddFindRequest("empty request"s);
+        }
+        ASSERT_EQUAL(request_queue.GetNoResultRequests(), 100);
+        for (int i = 0; i < 100; ++i) {
+            request_queue.AddFindRequest("curly dog"s);
+        }
+        ASSERT_EQUAL(request_queue.GetNoResultRequests(), 0);
+    }
+
+    // тексты запросов хранятся только по требованию
+    {
+        RequestQueue request_queue(search_server, 3, true);
+        for (const string& query : {"cat"s, "dog"s, "sparrow"s, "collar"s}) {
+            request_queue.AddFindRequest(query);
+        }
+        ASSERT(request_queue.GetQueries() == vector<string>({"dog"s, "sparrow"s, "collar"s}));
+        ASSERT(request_queue.GetAverageLatency() >= chrono::microseconds(0));
+    }
+
+    // запросы по статусу обслуживаются из кэша сервера
+    {
+        search_server.SetQueryCacheCapacity(10);
+        RequestQueue request_queue(search_server);
+        for (int i = 0; i < 5; ++i) {
+            ASSERT_EQUAL(request_queue.AddFindRequest("curly dog"s).size(), 4u);
+            request_queue.AddFindRequest("big cat"s, DocumentStatus::BANNED);
+        }
+        const auto statistics = search_server.GetQueryCacheStatistics();
+        ASSERT_EQUAL(statistics.misses, 2u);
+        ASSERT_EQUAL(statistics.hits, 8u);
+    }
+    ASSERT_THROWS(RequestQueue(search_server, 0), invalid_argument);
+}
+
+void TestMetrics() {
+    // корзина гистограммы накрывает значение с относительной ошибкой не больше 1/16
+    for (const uint64_t value : {0ull, 1ull, 15ull, 16ull, 17ull, 1000ull, 123'456'789ull, 1ull << 40}) {
+        const uint64_t upper_bound = LatencyHistogram::GetBucketUpperBound(LatencyHistogram::GetBucketIndex(value));
+        ASSERT(upper_bound >= value);
+        ASSERT(upper_bound - value <= value / 16);
+    }
+    ASSERT_EQUAL(LatencyHistogram::GetBucketIndex(numeric_limits<uint64_t>::max()), LatencyHistogram::BUCKET_COUNT - 1);
+
+    {
+        LatencyHistogram histogram;
+        ASSERT_EQUAL(histogram.GetValueAtPercentile(50.0), 0u);
+        for (uint64_t value = 1; value <= 1000; ++value) {
+            histogram.Add(value * 1000);
+        }
+        ASSERT_EQUAL(histogram.GetCount(), 1000u);
+        ASSERT_EQUAL(histogram.GetSum(), 500'500'000u);
+        ASSERT_EQUAL(histogram.GetMax(), 1'000'000u);
+        const uint64_t median = histogram.GetValueAtPercentile(50.0);
+        ASSERT(median >= 500'000 && median <= 500'000 + 500'000 / 16);
+        ASSERT_EQUAL(histogram.GetValueAtPercentile(100.0), 1'000'000u);
+
+        LatencyHistogram other;
+        other.Add(5'000'000);
+        histogram.Merge(other);
+        ASSERT_EQUAL(histogram.GetCount(), 1001u);
+        ASSERT_EQUAL(histogram.GetMax(), 5'000'000u);
+    }
+
+    SearchServer search_server("and in at"s);
+    const auto before_add = TakeMetricsSnapshot();
+    search_server.AddDocument(1, "curly cat curly tail"sv, DocumentStatus::ACTUAL, {7, 2, 7});
+    search_server.AddDocuments({{2, "curly dog and fancy collar"sv, DocumentStatus::ACTUAL, {1, 2, 3}},
+                                {3, "big cat fancy collar"sv, DocumentStatus::ACTUAL, {1, 2, 8}}});
+    const auto after_add = TakeMetricsSnapshot();
+    // одиночное добавление и пакет записывают по событию каждой стадии
+    for (const Stage stage : {Stage::ADD_PARSE, Stage::ADD_INDEX, Stage::ADD_STATISTICS}) {
+        ASSERT(after_add.GetStage(stage).GetCount() >= before_add.GetStage(stage).GetCount() + 2);
+    }
+
+    // запросы считают разбор, просмотренные постинги и оценённые документы
+    const auto before_find = TakeMetricsSnapshot();
+    search_server.FindTopDocuments("curly -collar"s);
+    search_server.FindTopDocuments(execution::par, "fancy cat"s);
+    const auto after_find = TakeMetricsSnapshot();
+    ASSERT(after_find.GetStage(Stage::QUERY_PARSE).GetCount() >= before_find.GetStage(Stage::QUERY_PARSE).GetCount() + 2);
+    ASSERT(after_find.GetStage(Stage::QUERY_MINUS_WORDS).GetCount() > before_find.GetStage(Stage::QUERY_MINUS_WORDS).GetCount());
+    ASSERT(after_find.GetStage(Stage::QUERY_PLUS_WORDS).GetCount() >= before_find.GetStage(Stage::QUERY_PLUS_WORDS).GetCount() + 2);
+    ASSERT(after_find.GetStage(Stage::QUERY_TOP_K).GetCount() >= before_find.GetStage(Stage::QUERY_TOP_K).GetCount() + 2);
+    ASSERT(after_find.GetCounter(Counter::POSTINGS_SCANNED) >= before_find.GetCounter(Counter::POSTINGS_SCANNED) + 7);
+    ASSERT(after_find.GetCounter(Counter::DOCUMENTS_SCORED) >= before_find.GetCounter(Counter::DOCUMENTS_SCORED) + 4);
+
+    search_server.RemoveDocument(3);
+    const auto after_remove = TakeMetricsSnapshot();
+    ASSERT(after_remove.GetStage(Stage::REMOVE_MARK).GetCount() > after_find.GetStage(Stage::REMOVE_MARK).GetCount());
+    ASSERT(after_remove.GetStage(Stage::REMOVE_STATISTICS).GetCount() > after_find.GetStage(Stage::REMOVE_STATISTICS).GetCount());
+
+    // события завершившегося потока не теряются
+    const auto before_thread = TakeMetricsSnapshot();
+    thread([]() {
+        RecordStage(Stage::QUERY_RESULTS, chrono::milliseconds(3));
+        AddToCounter(Counter::DOCUMENTS_SCORED, 10);
+    }).join();
+    const auto after_thread = TakeMetricsSnapshot();
+    ASSERT(after_thread.GetStage(Stage::QUERY_RESULTS).GetCount() > before_thread.GetStage(Stage::QUERY_RESULTS).GetCount());
+    ASSERT(after_thread.GetStage(Stage::QUERY_RESULTS).GetMax() >= 3'000'000u);
+    ASSERT(after_thread.GetCounter(Counter::DOCUMENTS_SCORED) >= before_thread.GetCounter(Counter::DOCUMENTS_SCORED) + 10);
+
+    // выключенные метрики ничего не записывают
+    SetMetricsEnabled(false);
+    ASSERT(!IsMetricsEnabled());
+    const auto before_disabled = TakeMetricsSnapshot();
+    RecordStage(Stage::QUERY_RESULTS, chrono::milliseconds(1));
+    AddToCounter(Counter::DOCUMENTS_SCORED, 10);
+    { StageTimer timer(Stage::QUERY_RESULTS); }
+    const auto after_disabled = TakeMetricsSnapshot();
+    SetMetricsEnabled(true);
+    ASSERT_EQUAL(after_disabled.GetStage(Stage::QUERY_RESULTS).GetCount(), before_disabled.GetStage(Stage::QUERY_RESULTS).GetCount());
+    ASSERT_EQUAL(after_disabled.GetCounter(Counter::DOCUMENTS_SCORED), before_disabled.GetCounter(Counter::DOCUMENTS_SCORED));
+
+    // таймер, который так и не запускался, не записывает событие
+    {
+        const auto before_timer = TakeMetricsSnapshot();
+        { StageTimer timer(Stage::QUERY_RESULTS, false); }
+        ASSERT_EQUAL(TakeMetricsSnapshot().GetStage(Stage::QUERY_RESULTS).GetCount(), before_timer.GetStage(Stage::QUERY_RESULTS).GetCount());
+    }
+
+    // экспорт в форматах Prometheus и JSON
+    {
+        ostringstream prometheus;
+        WriteMetrics(after_thread, MetricsFormat::PROMETHEUS, prometheus);
+        const string text = prometheus.str();
+        ASSERT(text.find("# TYPE search_server_stage_duration_seconds histogram\n"s) != string::npos);
+        ASSERT(text.find("search_server_stage_duration_seconds_bucket{stage=\"query_results\",le=\"+Inf\"}"s) != string::npos);
+        ASSERT(text.find("search_server_stage_duration_seconds_count{stage=\"add_parse\"}"s) != string::npos);
+        ASSERT(text.find("search_server_postings_scanned_total "s) != string::npos);
+
+        ostringstream json;
+        WriteMetrics(after_thread, MetricsFormat::JSON, json);
+        ASSERT(json.str().find("\"query_top_k\":{\"count\":"s) != string::npos);
+        ASSERT(json.str().find("\"documents_scored\":"s) != string::npos);
+
+        const string path = (filesystem::temp_directory_path() / "search_server_metrics.json"s).string();
+        SaveMetrics(path, MetricsFormat::JSON);
+        ifstream input(path);
+        string saved((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+        ASSERT(saved.rfind("{\"stages\":{"s, 0) == 0);
+        filesystem::remove(path);
+        ASSERT_THROWS(SaveMetrics((filesystem::temp_directory_path() / "no_such_directory"s / "metrics.txt"s).string(), MetricsFormat::PROMETHEUS),
+                      runtime_error);
+    }
+}
@@ -8,6 +8,8 @@
 
 #include "log_duration.h"
 #include "search_server.h"
+#include "sharded_search_server.h"
+#include "snapshot_search_server.h"
 
 std::string GenerateWord(std::mt19937& generator, int max_length);
 
@@ -36,6 +38,42 @@ void TestParMatchDocument();
 
 void TestParFindTopDocuments();
 
+void TestCompressIndex();
+
+void TestPrunedFindTopDocuments();
+
+void TestAddDocuments();
+
+void TestSnapshotSearchServer();
+
+void TestShardedSearchServer();
+
+void TestSaveLoadIndex();
+
+void TestDurableSearchServer();
+
+void TestQueryExecutor();
+
+void TestQueryCache();
+
+void TestPreparedQuery();
+
+void TestForEachCheckedWord();
+
+void TestLoadCorpus();
+
+void TestPurgeRemovedDocuments();
+
+void TestDuplicateDocuments();
+
+void TestNearDuplicateDocuments();
+
+void TestBatchMatchDocuments();
+
+void TestRequestQueue();
+
+void TestMetrics();
+
 template <typename ExecutionPolicy>
 void TestParMatchDocument(std::string_view mark, SearchServer search_server, const std::string& query, ExecutionPolicy&& policy) {
     LOG_DURATION(mark);
@@ -0,0 +1,206 @@
+#include "write_ahead_log.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <execution>
+#include <filesystem>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "index_file.h"
+
+using namespace std;
+
+namespace {
+
+/// Every record starts with the size and the checksum of its payload
+constexpr const size_t RECORD_HEADER_SIZE = sizeof(uint32_t) + sizeof(uint64_t);
+
+template <typename T>
+void AppendValue(string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+/// Sequential reader of record fields, throws std::out_of_range past the end
+class PayloadReader {
+   public:
+    explicit PayloadReader(string_view payload) : payload_{payload} {}
+
+    template <typename T>
+    T Read() {
+        T value;
+        memcpy(&value, ReadBytes(sizeof(value)).data(), sizeof(value));
+        return value;
+    }
+
+    string_view ReadBytes(size_t size) {
+        if (size > payload_.size()) {
+            throw out_of_range("Log record is truncated"s);
+        }
+        const string_view result = payload_.substr(0, size);
+        payload_.remove_prefix(size);
+        return result;
+    }
+
+   private:
+    string_view payload_;
+};
+
+}  // namespace
+
+WriteAheadLog::WriteAheadLog(const string& path, size_t valid_size) {
+    fd_ = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (fd_ < 0) {
+        throw runtime_error("Cannot open log "s + path + ": "s + strerror(errno));
+    }
+    if (ftruncate(fd_, static_cast<off_t>(valid_size)) != 0 || lseek(fd_, 0, SEEK_END) < 0) {
+        const int error = errno;
+        close(fd_);
+        throw runtime_error("Cannot prepare log "s + path + ": "s + strerror(error));
+    }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    try {
+        Sync(GetLastSequence());
+    } catch (const exception&) {
+    }
+    close(fd_);
+}
+
+WriteAheadLog::Sequence WriteAheadLog::AppendAddDocument(int document_id, string_view document, DocumentStatus status,
+                                                         const vector<int>& ratings) {
+    string payload;
+    AppendValue(payload, RecordType::ADD_DOCUMENT);
+    AppendValue(payload, static_cast<int32_t>(document_id));
+    AppendValue(payload, static_cast<int32_t>(status));
+    AppendValue(payload, static_cast<uint32_t>(ratings.size()));
+    for (const int rating : ratings) {
+        AppendValue(payload, static_cast<int32_t>(rating));
+    }
+    AppendValue(payload, static_cast<uint32_t>(document.size()));
+    payload.append(document);
+    return Append(payload);
+}
+
+WriteAheadLog::Sequence WriteAheadLog::AppendRemoveDocument(int document_id) {
+    string payload;
+    AppendValue(payload, RecordType::REMOVE_DOCUMENT);
+    AppendValue(payload, static_cast<int32_t>(document_id));
+    return Append(payload);
+}
+
+WriteAheadLog::Sequence WriteAheadLog::GetLastSequence() const {
+    lock_guard guard(mutex_);
+    return last_sequence_;
+}
+
+void WriteAheadLog::Sync(Sequence sequence) {
+    unique_lock lock(mutex_);
+    while (synced_sequence_ < sequence) {
+        if (is_failed_) {
+            throw runtime_error("Log is not writable after a failed write"s);
+        }
+        // A sync in progress may not cover the sequence, so waiters check again once it is over
+        if (is_syncing_) {
+            synced_condition_.wait(lock);
+            continue;
+        }
+
+        is_syncing_ = true;
+        const string batch = move(buffer_);
+        buffer_.clear();
+        const Sequence batch_sequence = last_sequence_;
+        lock.unlock();
+
+        bool is_written = true;
+        for (size_t written = 0; written < batch.size();) {
+            const ssize_t result = write(fd_, batch.data() + written, batch.size() - written);
+            if (result < 0 && errno != EINTR) {
+                is_written = false;
+                break;
+            }
+            written += max<ssize_t>(result, 0);
+        }
+        is_written = is_written && fdatasync(fd_) == 0;
+
+        lock.lock();
+        is_syncing_ = false;
+        is_failed_ = !is_written;
+        if (is_written) {
+            synced_sequence_ = batch_sequence;
+        }
+        synced_condition_.notify_all();
+    }
+}
+
+size_t WriteAheadLog::Replay(const string& path, SearchServer& server) {
+    if (!filesystem::exists(path)) {
+        return 0;
+    }
+    const MappedFile file(path);
+    const string_view data(file.Data(), file.Size());
+
+    // Texts of consecutive additions are views of the mapped file, which outlives the batch
+    vector<NewDocument> batch;
+    const auto apply_batch = [&batch, &server]() {
+        if (!batch.empty()) {
+            server.AddDocuments(execution::par, batch);
+            batch.clear();
+        }
+    };
+
+    size_t pos = 0;
+    while (data.size() - pos >= RECORD_HEADER_SIZE) {
+        PayloadReader header_reader(data.substr(pos, RECORD_HEADER_SIZE));
+        const auto size = header_reader.Read<uint32_t>();
+        const auto checksum = header_reader.Read<uint64_t>();
+        if (size > data.size() - pos - RECORD_HEADER_SIZE) {
+            break;
+        }
+        const string_view payload = data.substr(pos + RECORD_HEADER_SIZE, size);
+        if (ComputeChecksum(payload.data(), payload.size()) != checksum) {
+            break;
+        }
+
+        PayloadReader reader(payload);
+        const auto type = reader.Read<RecordType>();
+        if (type == RecordType::ADD_DOCUMENT) {
+            NewDocument document;
+            document.id = reader.Read<int32_t>();
+            document.status = static_cast<DocumentStatus>(reader.Read<int32_t>());
+            document.ratings.resize(reader.Read<uint32_t>());
+            for (int& rating : document.ratings) {
+                rating = reader.Read<int32_t>();
+            }
+            document.text = reader.ReadBytes(reader.Read<uint32_t>());
+            batch.push_back(move(document));
+        } else if (type == RecordType::REMOVE_DOCUMENT) {
+            apply_batch();
+            server.RemoveDocument(reader.Read<int32_t>());
+        } else {
+            throw runtime_error("Log "s + path + " has a record of unknown type"s);
+        }
+        pos += RECORD_HEADER_SIZE + size;
+    }
+    apply_batch();
+    return pos;
+}
+
+WriteAheadLog::Sequence WriteAheadLog::Append(const string& payload) {
+    lock_guard guard(mutex_);
+    if (is_failed_) {
+        throw runtime_error("Log is not writable after a failed write"s);
+    }
+    AppendValue(buffer_, static_cast<uint32_t>(payload.size()));
+    AppendValue(buffer_, ComputeChecksum(payload.data(), payload.size()));
+    buffer_.append(payload);
+    return ++last_sequence_;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "document.h"
+#include "search_server.h"
+
+/// Append-only log of search server mutations.
+///
+/// Every record is framed by its size and checksum. Appending only buffers the record; Sync makes it durable.
+/// Concurrent Sync calls are grouped: one caller writes everything buffered so far with a single write and fsync
+/// while the others wait for it, so a batch of mutations costs one sequential write.
+class WriteAheadLog {
+   public:
+    /// Number of a record in the log, starting from 1
+    using Sequence = uint64_t;
+
+    /// Opens log at path for appending, creating it if needed. The file is cut to valid_size first, dropping a torn
+    /// tail found by Replay. Throws std::runtime_error if the file cannot be opened.
+    WriteAheadLog(const std::string& path, size_t valid_size);
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    /// Syncs buffered records
+    ~WriteAheadLog();
+
+    Sequence AppendAddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+
+    Sequence AppendRemoveDocument(int document_id);
+
+    /// Sequence of the last appended record
+    Sequence GetLastSequence() const;
+
+    /// Blocks until records up to sequence are written and synced to disk.
+    /// Throws std::runtime_error if writing fails; the log accepts no more records after that.
+    void Sync(Sequence sequence);
+
+    /// Applies records of log at path to server in order, consecutive additions as one batch.
+    /// Stops at the first torn or corrupted record and returns the size of the valid prefix of the file.
+    static size_t Replay(const std::string& path, SearchServer& server);
+
+   private:
+    enum class RecordType : uint8_t { ADD_DOCUMENT = 1, REMOVE_DOCUMENT };
+
+    int fd_ = -1;
+    mutable std::mutex mutex_;
+    std::condition_variable synced_condition_;
+    /// Records appended but not written yet
+    std::string buffer_;
+    Sequence last_sequence_ = 0;
+    Sequence synced_sequence_ = 0;
+    bool is_syncing_ = false;
+    bool is_failed_ = false;
+
+    Sequence Append(const std::string& payload);
+};